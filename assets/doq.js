@@ -10,6 +10,249 @@ function doq_togglesidenav() {
         x.style.display = "none";
     } else {
         x.style.display = "block";
+        /* Nothing was visible while it was hidden, so rows must be rendered now */
+        doq_nav_render();
     }
 }
 
+
+/** Sidebar **/
+
+/* Height of a sidebar row, in pixels (should match '.doq-nav-row' in 'doq.css') */
+var DOQ_NAV_ROW = 22;
+
+/* Number of rows rendered above and below the visible ones, so scrolling doesn't show gaps */
+var DOQ_NAV_OVERSCAN = 10;
+
+/* Sidebar state (or null if 'nav.js' hasn't loaded yet) */
+var doq_nav = null;
+
+/* Called by 'nav.js', with entries in pre-order as parallel arrays of names, IDs, and parent indices */
+function doq_nav_load(name, id, par) {
+    var n = name.length;
+    var depth = new Int32Array(n), end = new Int32Array(n), open = new Uint8Array(n);
+    for (var i = 0; i < n; ++i) {
+        depth[i] = par[i] < 0 ? 0 : depth[par[i]] + 1;
+        /* Top level entries start expanded */
+        open[i] = depth[i] == 0 ? 1 : 0;
+    }
+    /* 'end[i]' is the index after the last entry in the subtree of 'i' */
+    for (var i = n - 1; i >= 0; --i) {
+        if (end[i] == 0) end[i] = i + 1;
+        if (par[i] >= 0 && end[par[i]] < end[i]) end[par[i]] = end[i];
+    }
+
+    doq_nav = {
+        name: name, id: id, par: par, depth: depth, end: end, open: open,
+        /* Visible entries, and how many there are */
+        vis: new Int32Array(n), nvis: 0,
+        /* Map of IDs to indices (built when first needed) */
+        idx: null,
+        /* Row elements, which are reused as the sidebar scrolls */
+        rows: [],
+    };
+
+    var elem = document.getElementById("doq-nav");
+    elem.addEventListener("click", function(ev) {
+        var t = ev.target;
+        if (t.className == "doq-nav-toggle" && t.parentNode.doq_navi >= 0) {
+            var i = t.parentNode.doq_navi;
+            doq_nav.open[i] = doq_nav.open[i] ? 0 : 1;
+            doq_nav_update();
+        }
+    });
+    document.getElementById("sidenav").addEventListener("scroll", doq_nav_render);
+    window.addEventListener("resize", doq_nav_render);
+    window.addEventListener("hashchange", doq_nav_reveal);
+
+    doq_nav_reveal();
+}
+
+/* Expands the entries leading to the current location, so it is shown in the sidebar */
+function doq_nav_reveal() {
+    var nav = doq_nav;
+    if (nav.idx === null) {
+        nav.idx = {};
+        for (var i = 0; i < nav.id.length; ++i) {
+            if (!(nav.id[i] in nav.idx)) nav.idx[nav.id[i]] = i;
+        }
+    }
+    var i = nav.idx[decodeURIComponent(location.hash.substring(1))];
+    if (i !== undefined) {
+        for (i = nav.par[i]; i >= 0; i = nav.par[i]) {
+            nav.open[i] = 1;
+        }
+    }
+    doq_nav_update();
+}
+
+/* Recomputes which entries are visible (skipping the subtrees of collapsed entries), and re-renders */
+function doq_nav_update() {
+    var nav = doq_nav, n = nav.name.length, nvis = 0;
+    for (var i = 0; i < n; ) {
+        nav.vis[nvis++] = i;
+        i = nav.open[i] ? i + 1 : nav.end[i];
+    }
+    nav.nvis = nvis;
+    document.getElementById("doq-nav").style.height = (nvis * DOQ_NAV_ROW) + "px";
+    doq_nav_render();
+}
+
+/* Renders the rows that are scrolled into view (the number of elements only depends on the window height) */
+function doq_nav_render() {
+    var nav = doq_nav;
+    if (nav === null) return;
+    var box = document.getElementById("sidenav"), elem = document.getElementById("doq-nav");
+
+    var first = Math.floor((box.scrollTop - elem.offsetTop) / DOQ_NAV_ROW) - DOQ_NAV_OVERSCAN;
+    if (first < 0) first = 0;
+    var count = Math.ceil(box.clientHeight / DOQ_NAV_ROW) + 2 * DOQ_NAV_OVERSCAN;
+    if (first + count > nav.nvis) count = Math.max(nav.nvis - first, 0);
+
+    while (nav.rows.length < count) {
+        var row = document.createElement("div"), tog = document.createElement("span"), a = document.createElement("a");
+        row.className = "doq-nav-row";
+        tog.className = "doq-nav-toggle";
+        row.appendChild(tog);
+        row.appendChild(a);
+        row.doq_navi = -1;
+        elem.appendChild(row);
+        nav.rows.push(row);
+    }
+
+    for (var j = 0; j < nav.rows.length; ++j) {
+        var row = nav.rows[j];
+        if (j >= count) {
+            row.style.display = "none";
+            row.doq_navi = -1;
+            continue;
+        }
+        var k = first + j, i = nav.vis[k];
+        row.style.display = "";
+        row.style.top = (k * DOQ_NAV_ROW) + "px";
+        row.style.paddingLeft = (nav.depth[i] * 12) + "px";
+        row.doq_navi = i;
+        row.firstChild.textContent = nav.end[i] > i + 1 ? (nav.open[i] ? "\u25BE" : "\u25B8") : "";
+        row.lastChild.textContent = nav.name[i];
+        row.lastChild.href = "#" + nav.id[i];
+    }
+}
+
+
+/* Highlights code blocks that were not highlighted when the page was generated (requires highlight.js) */
+function doq_highlight() {
+    document.addEventListener("DOMContentLoaded", function() {
+        document.querySelectorAll("pre code:not(.hljs)").forEach(function(block) {
+            hljs.highlightBlock(block);
+        });
+    });
+}
+
+
+/** Search **/
+
+/* Documents in the search index, as [id, title] pairs (or null if not loaded yet) */
+var doq_search_docs_ = null;
+
+/* Loaded shards, mapping shard names to maps of terms to [doc, tf, doc, tf, ...] arrays */
+var doq_search_shards = {};
+
+/* Current query */
+var doq_search_query = "";
+
+/* Load a script from the 'search/' directory (this works for pages opened from disk, unlike 'fetch()') */
+function doq_search_script(name) {
+    var s = document.createElement("script");
+    s.src = "search/" + name + ".js";
+    document.head.appendChild(s);
+}
+
+/* Called by 'search/docs.js' */
+function doq_search_docs(docs) {
+    doq_search_docs_ = docs;
+    doq_search(doq_search_query);
+}
+
+/* Called by each shard of the search index */
+function doq_search_load(name, terms) {
+    doq_search_shards[name] = terms;
+    doq_search(doq_search_query);
+}
+
+/* Split text into terms, the same way doq does (lowercase, and at least 2 bytes) */
+function doq_search_terms(text) {
+    return text.toLowerCase().split(/[^a-z0-9_\u0080-\uffff]+/).filter(function(t) {
+        return new TextEncoder().encode(t).length >= 2;
+    });
+}
+
+/* Return the shard name for a term (hex of the first two bytes) */
+function doq_search_shard(term) {
+    var b = new TextEncoder().encode(term), res = "";
+    for (var i = 0; i < 2 && i < b.length; ++i) {
+        res += (b[i] < 16 ? "0" : "") + b[i].toString(16);
+    }
+    return res;
+}
+
+/* Search for 'query', and show the results (loading shards as needed) */
+function doq_search(query) {
+    doq_search_query = query;
+    var out = document.getElementById("doq-search-results");
+    var terms = doq_search_terms(query);
+    out.innerHTML = "";
+    if (terms.length == 0) return;
+
+    /* Make sure everything needed is loaded (this is called again once it is) */
+    var ready = true;
+    if (doq_search_docs_ === null) {
+        if (doq_search_docs_ !== false) doq_search_script("docs");
+        doq_search_docs_ = false;
+        ready = false;
+    } else if (doq_search_docs_ === false) {
+        ready = false;
+    }
+    for (var i = 0; i < terms.length; ++i) {
+        var name = doq_search_shard(terms[i]);
+        if (!(name in doq_search_shards)) {
+            doq_search_shards[name] = null;
+            doq_search_script(name);
+        }
+        if (!doq_search_shards[name]) ready = false;
+    }
+    if (!ready) return;
+
+    /* Score documents with TF-IDF, requiring every term (the last term may be a prefix, since it may still be typed) */
+    var ndocs = doq_search_docs_.length, scores = null;
+    for (var i = 0; i < terms.length; ++i) {
+        var shard = doq_search_shards[doq_search_shard(terms[i])], cur = {};
+        for (var t in shard) {
+            var exact = t == terms[i];
+            if (!exact && !(i == terms.length - 1 && t.startsWith(terms[i]))) continue;
+            var p = shard[t], idf = Math.log(1 + ndocs / (p.length / 2));
+            for (var j = 0; j < p.length; j += 2) {
+                cur[p[j]] = (cur[p[j]] || 0) + (exact ? 1.0 : 0.5) * Math.log(1 + p[j + 1]) * idf;
+            }
+        }
+        if (scores === null) {
+            scores = cur;
+        } else {
+            for (var d in scores) {
+                if (d in cur) scores[d] += cur[d];
+                else delete scores[d];
+            }
+        }
+    }
+
+    var res = Object.keys(scores).sort(function(a, b) { return scores[b] - scores[a]; }).slice(0, 25);
+    for (var i = 0; i < res.length; ++i) {
+        var doc = doq_search_docs_[res[i]];
+        var li = document.createElement("li"), a = document.createElement("a");
+        a.href = "#" + doc[0];
+        a.textContent = doc[1];
+        li.appendChild(a);
+        out.appendChild(li);
+    }
+    /* The sidebar rows moved down */
+    doq_nav_render();
+}
@@ -4,6 +4,9 @@
  * 
  * SEE: https://highlightjs.readthedocs.io/en/latest/language-guide.html
  * 
+ * NOTE: doq highlights 'ks' code blocks at build time with the grammar in 'src/highlight.cc', which mirrors
+ *   the lists here (so, keep them in sync). This file is only used on pages that also load highlight.js
+ * 
  * @author: Cade Brown <cade@kscript.org>
  */
 
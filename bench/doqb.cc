@@ -0,0 +1,71 @@
+/* doqb.cc - benchmark for the binary document format ('BinaryOutput' and 'bin::Reader')
+ *
+ * Writes 'examples/kscript.doq' in the binary format, and then measures opening it, and looking up every
+ *   anchor, compared with parsing the source again (which is what querying it would take otherwise)
+ *
+ * @author: Cade Brown <cade@kscript.org>
+ */
+
+#include <doq.hh>
+#include <chrono>
+
+using namespace doq;
+
+
+/* Seconds since 'st' */
+static double since(chrono::steady_clock::time_point st) {
+    return chrono::duration<double>(chrono::steady_clock::now() - st).count();
+}
+
+int main(int argc, char** argv) {
+    const char* src = argc > 1 ? argv[1] : "examples/kscript.doq";
+    string dest = "/tmp/doq-bench-doqb";
+
+    auto st = chrono::steady_clock::now();
+    Project* proj = new Project(readall(src));
+    double parse = since(st);
+
+    st = chrono::steady_clock::now();
+    BinaryOutput* out = new BinaryOutput(proj, dest);
+    out->init();
+    out->exec();
+    out->fini();
+    double write = since(st);
+
+    /* Open (and check) the file repeatedly */
+    int nopen = 1000;
+    st = chrono::steady_clock::now();
+    for (int i = 0; i < nopen; ++i) {
+        bin::Reader r(dest + "/index.doqb");
+    }
+    double open = since(st) / nopen;
+
+    /* Look up every anchor, a few times over */
+    bin::Reader r(dest + "/index.doqb");
+    vector<string> ids;
+    for (size_t i = 0; i < proj->anchors.size(); ++i) {
+        ids.push_back(proj->anchors[i].id);
+    }
+    int nrounds = 100;
+    size_t found = 0;
+    st = chrono::steady_clock::now();
+    for (int k = 0; k < nrounds; ++k) {
+        for (size_t i = 0; i < ids.size(); ++i) {
+            found += r.lookup(ids[i]) != NULL;
+        }
+    }
+    double lookup = since(st) / (nrounds * ids.size());
+    if (found != nrounds * ids.size()) {
+        fprintf(stderr, "doqb: only found %d of %d anchors\n", (int)found, (int)(nrounds * ids.size()));
+        return 1;
+    }
+
+    printf("%-24s %10.3f ms\n", "parse source", parse * 1e3);
+    printf("%-24s %10.3f ms\n", "write binary", write * 1e3);
+    printf("%-24s %10.3f us\n", "open binary", open * 1e6);
+    printf("%-24s %10.3f ns\n", "lookup anchor", lookup * 1e9);
+
+    delete out;
+    delete proj;
+    return 0;
+}
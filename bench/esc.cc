@@ -0,0 +1,80 @@
+/* esc.cc - microbenchmark for 'HTMLOutput::dump_esc'
+ *
+ * Measures escaping throughput (GB/s) on prose-like and code-like inputs. Output is written to '/dev/null',
+ *   so this mostly measures the scanner and the 'Writer' buffer
+ *
+ * @author: Cade Brown <cade@kscript.org>
+ */
+
+#include <doq.hh>
+#include <chrono>
+
+using namespace doq;
+
+
+/* Generate 'sz' bytes of input, using a fixed seed so runs are comparable
+ *
+ * 'special' is roughly the fraction of characters that need escaping, and 'nl' the fraction of newlines
+ */
+static string gen(size_t sz, double special, double nl) {
+    static const char specials[] = "<>&\"'";
+    static const char* words[] = { "the", "value", "of", "function", "returns", "an", "object", "which", "is", "list" };
+    string res;
+    res.reserve(sz + 16);
+
+    unsigned int seed = 12345;
+    while (res.size() < sz) {
+        seed = seed * 1103515245 + 12345;
+        double r = (seed >> 8) / (double)(1 << 24);
+        if (r < special) {
+            res += specials[(seed >> 4) % 5];
+        } else if (r < special + nl) {
+            res += '\n';
+        } else {
+            res += words[(seed >> 4) % 10];
+            res += ' ';
+        }
+    }
+    res.resize(sz);
+    return res;
+}
+
+/* Time escaping 'total' bytes of 'x', in chunks of 'chunk' bytes, and print the throughput */
+static void run(const char* name, const string& x, size_t chunk, bool para, size_t total) {
+    HTMLOutput out(NULL, "");
+    out.fp.open("/dev/null");
+    out.doparastk.push_back(para);
+
+    vector<string> parts;
+    for (size_t i = 0; i < x.size(); i += chunk) {
+        parts.push_back(x.substr(i, chunk));
+    }
+
+    auto st = chrono::steady_clock::now();
+    size_t done = 0;
+    while (done < total) {
+        for (size_t i = 0; i < parts.size(); ++i) {
+            out.dump_esc(parts[i]);
+        }
+        done += x.size();
+    }
+    out.fp.flush();
+    double el = chrono::duration<double>(chrono::steady_clock::now() - st).count();
+
+    printf("%-24s %8.3f GB/s\n", name, done / el / 1e9);
+}
+
+int main(int argc, char** argv) {
+    size_t total = 1 << 30;
+
+    /* Prose: rare escapes, paragraphs split by newlines */
+    string prose = gen(1 << 20, 0.002, 0.01);
+    run("prose (para)", prose, 4096, true, total);
+    run("prose (tokens)", prose, 8, true, total / 8);
+
+    /* Code: frequent escapes, no paragraphs */
+    string code = gen(1 << 20, 0.05, 0.03);
+    run("code", code, 4096, false, total);
+
+    return 0;
+}
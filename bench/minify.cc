@@ -0,0 +1,73 @@
+/* minify.cc - microbenchmark for 'Minifier'
+ *
+ * Measures the throughput (GB/s) of writing HTML-like output through a 'Writer', with and without minifying.
+ *   Output is written to '/dev/null', so this mostly measures the filter and the 'Writer' buffer
+ *
+ * @author: Cade Brown <cade@kscript.org>
+ */
+
+#include <doq.hh>
+#include <chrono>
+
+using namespace doq;
+
+
+/* Generate about 'sz' bytes of indented markup, using a fixed seed so runs are comparable */
+static string gen(size_t sz) {
+    static const char* words[] = { "the", "value", "of", "function", "returns", "an", "object", "which", "is", "list" };
+    string res;
+    res.reserve(sz + 256);
+
+    unsigned int seed = 12345;
+    while (res.size() < sz) {
+        seed = seed * 1103515245 + 12345;
+        int r = (seed >> 8) % 16;
+        if (r == 0) {
+            res += "<!-- section -->\n";
+        } else if (r == 1) {
+            res += "<pre class='language-ks'><code>for x in range(10) {\n    print (x)\n}</code></pre>\n";
+        } else if (r < 4) {
+            res += "    <h2 id='x'>Title<a href='#x' class='link-div'></a></h2>\n";
+        } else {
+            res += "    <p>";
+            for (int i = 0; i < 12; ++i) {
+                res += words[(seed >> (i % 16)) % 10];
+                res += i % 5 == 4 ? "\n        " : " ";
+            }
+            res += "</p>\n";
+        }
+    }
+    return res;
+}
+
+/* Time writing 'total' bytes of 'x', in chunks of 'chunk' bytes, and print the throughput */
+static void run(const char* name, const string& x, size_t chunk, bool minify, size_t total) {
+    Writer fp;
+    fp.open("/dev/null");
+    if (minify) {
+        fp.minify();
+    }
+
+    auto st = chrono::steady_clock::now();
+    size_t done = 0;
+    while (done < total) {
+        for (size_t i = 0; i < x.size(); i += chunk) {
+            fp.write(x.data() + i, min(chunk, x.size() - i));
+        }
+        done += x.size();
+    }
+    fp.close();
+    double el = chrono::duration<double>(chrono::steady_clock::now() - st).count();
+
+    printf("%-24s %8.3f GB/s\n", name, done / el / 1e9);
+}
+
+int main(int argc, char** argv) {
+    size_t total = 1 << 30;
+
+    string html = gen(1 << 20);
+    run("plain", html, 64, false, total);
+    run("minify", html, 64, true, total);
+
+    return 0;
+}
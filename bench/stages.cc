@@ -0,0 +1,640 @@
+/* stages.cc - macro benchmark, which times each stage of a build on generated documents
+ *
+ * Generates a synthetic document of each size (see 'Corpus'), and times reading it, tokenizing it, parsing
+ *   it, rendering it to HTML, and writing the output. Documents are generated from a fixed seed, so runs are
+ *   comparable, and are kept in '/tmp/doq-bench-stages' between runs
+ *
+ * Results can be written as JSON ('--out'), and compared with the results of an earlier run ('--compare'),
+ *   in which case stages that got slower than the threshold are reported, and it exits with 1. 'make bench'
+ *   does both (see 'makefile')
+ *
+ * Usage: bench/stages [--sizes 1M,100M,1G] [--reps N] [--stream-above SIZE] [--out results.json]
+ *                     [--compare baseline.json] [--threshold PCT] [--depth N] [--macros X] [--code X]
+ *                     [--math X] [--unicode X] [--seed N]
+ *        bench/stages --gen SIZE file.doq [options]
+ *
+ * @author: Cade Brown <cade@kscript.org>
+ */
+
+#include <doq.hh>
+#include <chrono>
+#include <cmath>
+#include <ftw.h>
+
+using namespace doq;
+
+
+/* Directory for generated documents and output */
+static const string WORKDIR = "/tmp/doq-bench-stages";
+
+/* Stages that are timed */
+enum Stage {
+    READ,
+    TOKENIZE,
+    PARSE,
+    RENDER,
+    WRITE,
+    NSTAGES
+};
+static const char* stagenames[NSTAGES] = { "read", "tokenize", "parse", "render", "write" };
+
+/* Differences smaller than this (in seconds) are never reported as regressions, since they are mostly noise */
+static const double NOISE = 0.005;
+
+
+/* Parameters of a generated document */
+struct Corpus {
+
+    /* Size (in bytes) to generate, which is exceeded by at most one node */
+    size_t size = 1 << 20;
+
+    /* Maximum depth of nested nodes (1 means only top-level nodes) */
+    int depth = 4;
+
+    /* Fraction of words that are macros (like '@bold', '@ref', and '@math') instead of plain text */
+    double macros = 0.05;
+
+    /* Fraction of blocks that are code blocks, and math blocks (the rest are paragraphs and lists) */
+    double code = 0.15, math = 0.05;
+
+    /* Fraction of words that contain non-ASCII characters */
+    double unicode = 0.02;
+
+    /* Seed of the generator */
+    uint64_t seed = 1;
+
+    /* Returns the parameters (besides the size) as a string, which documents and results are keyed by */
+    string key() const {
+        char tmp[256];
+        snprintf(tmp, sizeof(tmp), "depth=%d macros=%g code=%g math=%g unicode=%g seed=%llu", depth, macros, code, math, unicode, (unsigned long long)seed);
+        return tmp;
+    }
+
+};
+
+/* Generates a document, writing it as it goes (so even large ones aren't kept in memory) */
+struct Generator {
+
+    const Corpus& c;
+    Writer& fp;
+
+    /* State of the random number generator */
+    uint64_t state;
+
+    /* Bytes written so far, and number of nodes */
+    size_t len;
+    int nnodes;
+
+    /* Text of the current block, which is written once it is done */
+    string buf;
+
+    Generator(const Corpus& c_, Writer& fp_) : c(c_), fp(fp_), state(c_.seed), len(0), nnodes(0) {}
+
+    /* Returns a random 64 bit integer (splitmix64) */
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    /* Returns a random integer in [0, n) */
+    int randint(int n) {
+        return next() % n;
+    }
+
+    /* Returns a random number in [0, 1) */
+    double randf() {
+        return (next() >> 11) * (1.0 / (1ULL << 53));
+    }
+
+    /* Write 'buf' */
+    void emit() {
+        fp.put(buf);
+        len += buf.size();
+        buf.clear();
+    }
+
+    /* Append a random word */
+    void word() {
+        static const char* words[] = {
+            "the", "value", "of", "function", "returns", "an", "object", "which", "is", "list", "a", "type",
+            "module", "string", "given", "argument", "each", "element", "and", "for", "iterator", "to", "in",
+            "number", "integer", "may", "be", "used", "with", "method", "result", "index", "default", "when",
+        };
+        static const char* uwords[] = {
+            "naïve", "café", "Größe", "façade", "Ζεύς", "λ", "Привет", "日本語", "文字列", "—", "→", "∑", "½", "🙂", "ℝ",
+        };
+        if (randf() < c.unicode) {
+            buf += uwords[randint(sizeof(uwords) / sizeof(*uwords))];
+        } else {
+            buf += words[randint(sizeof(words) / sizeof(*words))];
+        }
+    }
+
+    /* Append a random (inline) macro, or other markup */
+    void macro() {
+        int r = randint(8);
+        if (r == 0) {
+            buf += "{@bold ";
+            word();
+            buf += "}";
+        } else if (r == 1) {
+            buf += "{@italic ";
+            word();
+            buf += " ";
+            word();
+            buf += "}";
+        } else if (r == 2) {
+            buf += "`";
+            word();
+            buf += "()`";
+        } else if (r == 3) {
+            buf += "{@url https://example.org/docs/" + to_string(randint(1000)) + ", ";
+            word();
+            buf += "}";
+        } else if (r == 4 && nnodes > 1) {
+            /* References earlier nodes, so they always resolve */
+            buf += "{@ref Node " + to_string(randint(nnodes - 1)) + "}";
+        } else if (r == 5) {
+            buf += "{@math x_{" + to_string(randint(10)) + "}^2 + \\frac{a}{b}}";
+        } else if (r == 6) {
+            buf += "{@mono ";
+            word();
+            buf += "}";
+        } else {
+            buf += "{@underline ";
+            word();
+            buf += "}";
+        }
+    }
+
+    /* Append a sentence of 'n' words */
+    void sentence(int n) {
+        for (int i = 0; i < n; ++i) {
+            if (i > 0) buf += ' ';
+            if (randf() < c.macros) {
+                macro();
+            } else {
+                word();
+            }
+        }
+        buf += ". ";
+    }
+
+    /* Write a random block (a paragraph, list, code block, or math block) */
+    void block() {
+        double r = randf();
+        if (r < c.code) {
+            static const char* langs[] = { "ks", "py", "c", "" };
+            buf += "```";
+            buf += langs[randint(4)];
+            buf += "\n";
+            int n = 2 + randint(10);
+            for (int i = 0; i < n; ++i) {
+                int v = randint(100);
+                buf += "for x in range(" + to_string(v) + ") {\n    y = \"s\" + str(x * " + to_string(v) + ") < 3 && x\n}\n";
+            }
+            buf += "```\n\n";
+        } else if (r < c.code + c.math) {
+            buf += "{@mathblock \\sum_{k=0}^{N-1} x_k e^{-2 \\pi i j k / N} = \\sqrt{\\frac{" + to_string(randint(100)) + "}{\\alpha + \\beta}}}\n\n";
+        } else if (r < c.code + c.math + 0.05) {
+            buf += "@list ";
+            int n = 2 + randint(5);
+            for (int i = 0; i < n; ++i) {
+                if (i > 0) buf += ", ";
+                buf += "{";
+                sentence(3 + randint(6));
+                buf += "}";
+            }
+            buf += "\n\n";
+        } else {
+            int n = 2 + randint(6);
+            for (int i = 0; i < n; ++i) {
+                sentence(5 + randint(15));
+            }
+            buf += "\n\n";
+        }
+        emit();
+    }
+
+    /* Write a node, with children if it is above 'c.depth' */
+    void node(int d) {
+        buf += "@node Node " + to_string(nnodes++) + ", {";
+        sentence(3 + randint(8));
+        buf += "}, {\n\n";
+        emit();
+
+        int n = 1 + randint(5);
+        for (int i = 0; i < n; ++i) {
+            block();
+        }
+        if (d < c.depth) {
+            int nsub = randint(4);
+            for (int i = 0; i < nsub && len < c.size; ++i) {
+                node(d + 1);
+            }
+        }
+
+        buf += "}\n\n";
+        emit();
+    }
+
+    /* Write the whole document */
+    void gen() {
+        buf += ";; Generated by 'bench/stages' (" + c.key() + ")\n\n@set project, Benchmark\n\n";
+        emit();
+        while (len < c.size) {
+            node(1);
+        }
+    }
+
+};
+
+
+/* Parses a size, like '100M' */
+static size_t parsesize(const string& s) {
+    char* e;
+    double x = strtod(s.c_str(), &e);
+    size_t m = 1;
+    if (*e == 'K' || *e == 'k') m = 1 << 10, e++;
+    else if (*e == 'M' || *e == 'm') m = 1 << 20, e++;
+    else if (*e == 'G' || *e == 'g') m = 1 << 30, e++;
+    if (e == s.c_str() || *e != '\0' || x <= 0) {
+        throw runtime_error("Invalid size: '" + s + "' (expected a number of bytes, with an optional K, M, or G)");
+    }
+    return (size_t)(x * m);
+}
+
+/* Formats a size, like '100M' */
+static string sizename(size_t sz) {
+    if (sz % (1 << 30) == 0) return to_string(sz >> 30) + "G";
+    if (sz % (1 << 20) == 0) return to_string(sz >> 20) + "M";
+    if (sz % (1 << 10) == 0) return to_string(sz >> 10) + "K";
+    return to_string(sz);
+}
+
+/* Seconds since 'st' */
+static double since(chrono::steady_clock::time_point st) {
+    return chrono::duration<double>(chrono::steady_clock::now() - st).count();
+}
+
+/* Removes 'path' and everything in it, if it exists */
+static void rmtree(const string& path) {
+    nftw(path.c_str(), [](const char* p, const struct stat* st, int flag, struct FTW* ftw) {
+        return remove(p);
+    }, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+/* Writes a document with the parameters 'c' to 'fname' */
+static void generate(const Corpus& c, const string& fname) {
+    Writer fp;
+    fp.open(fname);
+    Generator g(c, fp);
+    g.gen();
+    fp.close();
+}
+
+/* Returns a document with the parameters 'c', generating it if it hasn't been already */
+static string corpus(const Corpus& c) {
+    string fname = WORKDIR + "/corpus-" + sizename(c.size) + "-" + to_string(hash64(c.key().data(), c.key().size()) & 0xFFFFFFFF) + ".doq";
+    if (access(fname.c_str(), F_OK) != 0) {
+        /* Generated under another name first, so an interrupted run doesn't leave a partial document */
+        fprintf(stderr, "stages: generating %s\n", fname.c_str());
+        generate(c, fname + ".tmp");
+        if (rename((fname + ".tmp").c_str(), fname.c_str()) != 0) {
+            throw runtime_error("Failed to write file: '" + fname + "'");
+        }
+    }
+    return fname;
+}
+
+
+/* Result of timing the stages on one document */
+struct Result {
+
+    /* Size of the document, and the parameters it was generated with */
+    size_t size;
+    string key;
+
+    /* Whether it was streamed (see 'Project::stream()') */
+    bool stream;
+
+    /* Time of each stage (in seconds), which is the best of the repetitions */
+    double t[NSTAGES];
+
+    /* Returns the total time */
+    double total() const {
+        double res = 0;
+        for (int i = 0; i < NSTAGES; ++i) res += t[i];
+        return res;
+    }
+
+};
+
+/* Times building 'fname' once, in memory
+ *
+ * The project's constructor tokenizes the source itself, so the time measured for 'TOKENIZE' is taken out of
+ *   'PARSE' (which also includes resolving references)
+ */
+static void runmem(const string& fname, const string& dest, double* t) {
+    auto st = chrono::steady_clock::now();
+    string src = readall(fname);
+    t[READ] = since(st);
+
+    st = chrono::steady_clock::now();
+    vector<Token> toks = tokenize(src);
+    t[TOKENIZE] = since(st);
+    toks = vector<Token>();
+
+    st = chrono::steady_clock::now();
+    Project* proj = new Project(src);
+    t[PARSE] = max(0.0, since(st) - t[TOKENIZE]);
+
+    st = chrono::steady_clock::now();
+    HTMLOutput* out = new HTMLOutput(proj, dest);
+    out->init();
+    out->exec();
+    t[RENDER] = since(st);
+
+    st = chrono::steady_clock::now();
+    out->fini();
+    t[WRITE] = since(st);
+
+    delete out;
+    delete proj;
+}
+
+/* Times building 'fname' once, streamed (so the document isn't kept in memory)
+ *
+ * Here, 'READ' is faulting in the mapping, and 'RENDER' includes parsing the content again (which streaming
+ *   does, see 'Project::stream()')
+ */
+static void runstream(const string& fname, const string& dest, double* t) {
+    auto st = chrono::steady_clock::now();
+    size_t size;
+    char* text = mapall(fname, size);
+    volatile char sum = 0;
+    for (size_t i = 0; i < size; i += 4096) {
+        sum += text[i];
+    }
+    t[READ] = since(st);
+
+    st = chrono::steady_clock::now();
+    Lexer lex(text, size);
+    vector<Token> toks;
+    while (!lex.done) {
+        toks.clear();
+        lex.lex(toks, 1 << 16);
+    }
+    t[TOKENIZE] = since(st);
+    toks = vector<Token>();
+
+    st = chrono::steady_clock::now();
+    Project* proj = new Project(text, size);
+    t[PARSE] = max(0.0, since(st) - t[TOKENIZE]);
+
+    st = chrono::steady_clock::now();
+    HTMLOutput* out = new HTMLOutput(proj, dest);
+    out->init();
+    out->exec();
+    t[RENDER] = since(st);
+
+    st = chrono::steady_clock::now();
+    out->fini();
+    t[WRITE] = since(st);
+
+    delete out;
+    delete proj;
+    unmapall(text, size);
+}
+
+/* Writes 'res' as JSON to 'fname', with one result per line (which 'load()' relies on) */
+static void save(const vector<Result>& res, const string& fname) {
+    Writer fp;
+    fp.open(fname);
+    fp.put("{\n    \"results\": [\n");
+    for (size_t i = 0; i < res.size(); ++i) {
+        const Result& r = res[i];
+        string line;
+        line += "        {\"size\": " + to_string(r.size) + ", \"corpus\": ";
+        jsonstr(line, r.key);
+        line += string(", \"mode\": \"") + (r.stream ? "stream" : "memory") + "\"";
+        char tmp[64];
+        for (int j = 0; j < NSTAGES; ++j) {
+            snprintf(tmp, sizeof(tmp), ", \"%s\": %.6f", stagenames[j], r.t[j]);
+            line += tmp;
+        }
+        snprintf(tmp, sizeof(tmp), ", \"total\": %.6f}", r.total());
+        line += tmp;
+        line += i + 1 < res.size() ? ",\n" : "\n";
+        fp.put(line);
+    }
+    fp.put("    ]\n}\n");
+    fp.close();
+}
+
+/* Sets 'val' to the string (without escapes) or number after '"key": ' in 'line', and returns whether
+ *   it was found
+ */
+static bool field(const string& line, const string& key, string& val) {
+    size_t i = line.find("\"" + key + "\": ");
+    if (i == string::npos) return false;
+    i += key.size() + 4;
+    if (line[i] == '"') {
+        size_t e = line.find('"', i + 1);
+        if (e == string::npos) return false;
+        val = line.substr(i + 1, e - i - 1);
+    } else {
+        size_t e = line.find_first_of(",}", i);
+        val = line.substr(i, e - i);
+    }
+    return true;
+}
+
+/* Reads results written by 'save()' */
+static vector<Result> load(const string& fname) {
+    vector<Result> res;
+    string data = readall(fname);
+    size_t st = 0;
+    while (st < data.size()) {
+        size_t en = data.find('\n', st);
+        if (en == string::npos) en = data.size();
+        string line = data.substr(st, en - st);
+        st = en + 1;
+
+        string val;
+        if (!field(line, "size", val)) continue;
+        Result r;
+        r.size = strtoull(val.c_str(), NULL, 10);
+        if (!field(line, "corpus", r.key) || !field(line, "mode", val)) {
+            throw runtime_error("Invalid results in: '" + fname + "'");
+        }
+        r.stream = val == "stream";
+        for (int j = 0; j < NSTAGES; ++j) {
+            if (!field(line, stagenames[j], val)) {
+                throw runtime_error("Invalid results in: '" + fname + "'");
+            }
+            r.t[j] = strtod(val.c_str(), NULL);
+        }
+        res.push_back(r);
+    }
+    return res;
+}
+
+/* Compares 'res' with 'base', printing stages that got slower by more than 'thresh' (a fraction), and
+ *   returns how many did
+ */
+static int compare(const vector<Result>& res, const vector<Result>& base, double thresh) {
+    int nreg = 0;
+    for (size_t i = 0; i < res.size(); ++i) {
+        const Result& r = res[i];
+        const Result* b = NULL;
+        for (size_t j = 0; j < base.size(); ++j) {
+            if (base[j].size == r.size && base[j].key == r.key && base[j].stream == r.stream) {
+                b = &base[j];
+                break;
+            }
+        }
+        if (!b) {
+            printf("%-8s not in the baseline\n", sizename(r.size).c_str());
+            continue;
+        }
+        for (int j = 0; j < NSTAGES; ++j) {
+            double d = r.t[j] - b->t[j];
+            if (d > NOISE && d > thresh * b->t[j]) {
+                printf("%-8s %-10s REGRESSION %10.3f ms -> %10.3f ms (%+.1f%%)\n", sizename(r.size).c_str(), stagenames[j], b->t[j] * 1e3, r.t[j] * 1e3, 100 * d / b->t[j]);
+                nreg++;
+            }
+        }
+    }
+    return nreg;
+}
+
+int main(int argc, char** argv) {
+    Corpus c;
+    vector<size_t> sizes = { 1 << 20, 100 << 20, (size_t)1 << 30 };
+    int reps = -1;
+    size_t streamabove = 16 << 20;
+    string outname, basename, genname;
+    double thresh = 0.25;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (i + 1 >= argc) {
+            throw runtime_error("Option '" + arg + "' requires a value");
+        }
+        string val = argv[++i];
+        if (arg == "--sizes") {
+            sizes.clear();
+            size_t st = 0;
+            while (st <= val.size()) {
+                size_t en = val.find(',', st);
+                if (en == string::npos) en = val.size();
+                if (en > st) sizes.push_back(parsesize(val.substr(st, en - st)));
+                st = en + 1;
+            }
+        } else if (arg == "--gen") {
+            if (i + 1 >= argc) {
+                throw runtime_error("Option '--gen' requires a size and a file, like '10M big.doq'");
+            }
+            c.size = parsesize(val);
+            genname = argv[++i];
+        } else if (arg == "--reps") {
+            reps = atoi(val.c_str());
+        } else if (arg == "--stream-above") {
+            streamabove = parsesize(val);
+        } else if (arg == "--out") {
+            outname = val;
+        } else if (arg == "--compare") {
+            basename = val;
+        } else if (arg == "--threshold") {
+            thresh = atof(val.c_str()) / 100;
+        } else if (arg == "--depth") {
+            c.depth = max(1, atoi(val.c_str()));
+        } else if (arg == "--macros") {
+            c.macros = atof(val.c_str());
+        } else if (arg == "--code") {
+            c.code = atof(val.c_str());
+        } else if (arg == "--math") {
+            c.math = atof(val.c_str());
+        } else if (arg == "--unicode") {
+            c.unicode = atof(val.c_str());
+        } else if (arg == "--seed") {
+            c.seed = strtoull(val.c_str(), NULL, 10);
+        } else {
+            throw runtime_error("Unknown option: " + arg);
+        }
+    }
+
+    /* Only generate a document */
+    if (genname.size() > 0) {
+        generate(c, genname);
+        return 0;
+    }
+
+    mkdir(WORKDIR.c_str(), 0777);
+    string dest = WORKDIR + "/out";
+
+    printf("%-8s %-7s", "size", "mode");
+    for (int j = 0; j < NSTAGES; ++j) {
+        printf(" %10s", stagenames[j]);
+    }
+    printf(" %10s %10s\n", "total", "MB/s");
+
+    vector<Result> res;
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        c.size = sizes[i];
+        string fname = corpus(c);
+
+        Result r;
+        r.size = c.size;
+        r.key = c.key();
+        r.stream = c.size > streamabove;
+        for (int j = 0; j < NSTAGES; ++j) {
+            r.t[j] = HUGE_VAL;
+        }
+
+        /* Small documents are repeated, to reduce noise */
+        int n = reps > 0 ? reps : (c.size <= (16 << 20) ? 5 : 1);
+        for (int k = 0; k < n; ++k) {
+            /* Start from an empty directory each time, so every file is written */
+            rmtree(dest);
+            double t[NSTAGES];
+            if (r.stream) {
+                runstream(fname, dest, t);
+            } else {
+                runmem(fname, dest, t);
+            }
+            for (int j = 0; j < NSTAGES; ++j) {
+                r.t[j] = min(r.t[j], t[j]);
+            }
+        }
+        rmtree(dest);
+        res.push_back(r);
+
+        printf("%-8s %-7s", sizename(r.size).c_str(), r.stream ? "stream" : "memory");
+        for (int j = 0; j < NSTAGES; ++j) {
+            printf(" %7.1f ms", r.t[j] * 1e3);
+        }
+        printf(" %7.1f ms %10.2f\n", r.total() * 1e3, r.size / r.total() / (1 << 20));
+        fflush(stdout);
+    }
+
+    if (outname.size() > 0) {
+        save(res, outname);
+    }
+    if (basename.size() > 0) {
+        if (access(basename.c_str(), F_OK) != 0) {
+            printf("no baseline at '%s' (see 'make bench-save')\n", basename.c_str());
+        } else {
+            int nreg = compare(res, load(basename), thresh);
+            if (nreg > 0) {
+                printf("%d regression(s) against '%s' (over %.0f%%)\n", nreg, basename.c_str(), thresh * 100);
+                return 1;
+            }
+            printf("no regressions against '%s'\n", basename.c_str());
+        }
+    }
+    return 0;
+}
@@ -19,16 +19,39 @@
 #include <time.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
 #include <sys/stat.h>
 
+/* POSIX */
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+/* Linux */
+#include <linux/fs.h>
+
 
 /* STL */
 #include <vector>
 #include <map>
+#include <set>
+#include <unordered_map>
 #include <string>
 #include <algorithm>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/* doq binary format */
+#include <doqb.hh>
 
 
 /* Using 'std::' */
@@ -42,6 +65,10 @@ extern string assetpath;
 /* Forward declarations */
 struct Project;
 struct Item;
+struct Compressor;
+struct Manifest;
+struct FileQueue;
+struct Inventory;
 
 /* Type definition of a macro function implemented in C++ */
 typedef Item* (*macro_f)(Project* proj, const vector<Item*>& args);
@@ -132,6 +159,33 @@ struct Token {
     string get(const string& src) {
         return src.substr(pos, len);
     }
+    string get(const char* src) {
+        return string(src + pos, len);
+    }
+
+};
+
+
+/* Turns source code into tokens, a chunk at a time (see 'tokenize()')
+ *
+ * The source must be followed by a NUL byte, which 'string' and 'mapall()' both guarantee
+ */
+struct Lexer {
+
+    /* Source code, and its length */
+    const char* src;
+    int sl;
+
+    /* Position in the source (offset, and 0-based line and column) */
+    int i, line, col;
+
+    /* Whether the final 'NONE' token has been emitted */
+    bool done;
+
+    Lexer(const char* src_, size_t sl_) : src(src_), sl(sl_), i(0), line(0), col(0), done(false) {}
+
+    /* Appends up to 'n' more tokens to 'res' (and the final 'NONE' token, once the end is reached) */
+    void lex(vector<Token>& res, size_t n);
 
 };
 
@@ -205,6 +259,11 @@ struct Item {
         DICT,
 
 
+        /* Image, with the path of the file in 'sval', and the alternate text in 'sub'
+         */
+        IMAGE,
+
+
     } kind;
 
     /* String value */
@@ -213,6 +272,24 @@ struct Item {
     /* Children Nodes*/
     vector<Item*> sub;
 
+    /* Source position (0-based line and column), or -1 if unknown */
+    int line = -1, col = -1;
+
+    /* For 'REF' items, the index of the resolved target in 'Project::anchors', or -1 if it could not be resolved
+     *
+     * NOTE: This is set by 'Project::resolve()'
+     */
+    int target = -1;
+
+    /* For 'REF' items that aren't defined in the project, but were found in an inventory of another project
+     *   (see 'Inventory'), the index of the URL in 'Project::externs', or -1 otherwise
+     */
+    int ext = -1;
+
+    /* Cached results of 'flatten()' and 'id()', valid if 'hasflat' and 'hasid' are set */
+    string flat, aid;
+    bool hasflat = false, hasid = false;
+
     Item(const string& sval_) : kind(Kind::JOIN), sval(sval_) {}
     Item(Kind kind_, const string& sval_, const vector<Item*>& sub_={}) : kind(kind_), sval(sval_), sub(sub_) {}
     Item(Kind kind_, const vector<Item*>& sub_={}) : kind(kind_), sub(sub_) {}
@@ -227,8 +304,21 @@ struct Item {
     Item* copy();
 
 
-    /* Return a string of the item, flattened. Mainly used to have a quick and dirty conversion to string */
-    string flatten();
+    /* Return a string of the item, flattened. Mainly used to have a quick and dirty conversion to string
+     *
+     * NOTE: The result is cached, so the item should not be modified afterwards
+     */
+    const string& flatten();
+
+    /* Append the flattened string of the item to 'res' */
+    void flatten(string& res);
+
+    /* Return the anchor ID of the item (see 'anchor()'). For 'REF' items, this is the ID being referenced (from 'sval'),
+     *   otherwise it is derived from the flattened string
+     *
+     * NOTE: The result is cached, so the item should not be modified afterwards
+     */
+    const string& id();
 
     /* Empty string item, "" */
     static Item* empty;
@@ -243,6 +333,9 @@ struct Node {
     /* The name of the page */
     string name;
 
+    /* Anchor ID of the page (see 'anchor()'), set by 'finalize()' */
+    string id;
+
     /* The descrpition of the page */
     string desc;
 
@@ -261,6 +354,24 @@ struct Node {
     /* reference IDs that the node contains */
     vector<string> contains;
 
+    /* Source positions (line, col) of 'contains' */
+    vector<pair<int, int>> containspos;
+
+    /* Source position of the node (0-based line and column), or -1 if unknown */
+    int line = -1, col = -1;
+
+    /* Index within 'par->sub', and depth from the root (the root has depth 0)
+     *
+     * NOTE: These are set by 'finalize()', once parsing is done
+     */
+    int idx = 0, depth = 0;
+
+    /* Section number, like '2.1.' (the top level is not numbered) */
+    string secnum;
+
+    /* Index of this node's entry in 'Project::nav', or -1 if it has not been indexed */
+    int navi = -1;
+
     Node(const string& name_, const string& desc_, Item* val_, Node* par_=NULL, const vector<Node*>& sub_={}) : name(name_), desc(desc_), val(val_), par(par_), sub(sub_) {}
 
     ~Node() {
@@ -270,6 +381,17 @@ struct Node {
         }
     }
 
+    /* Compute 'id', 'idx', 'depth', and 'secnum' for this node and all children
+     *
+     * Should be called on the root once the tree is complete
+     */
+    void finalize();
+
+    /* Compute 'id', 'idx', 'depth', and 'secnum' for the child 'ch' (which is at index 'i') and all its
+     *   children
+     */
+    void finalize(Node* ch, size_t i);
+
     /* Returns a vector of integers representing the indexes from the root */
     vector<int> get_posi();
 
@@ -281,6 +403,154 @@ struct Node {
 
 };
 
+/* Entry in the navigation index of a project (see 'Project::nav')
+ *
+ * This holds everything needed to render tables of contents and sidebars, without going back to
+ *   the 'Item' content of the node
+ */
+struct NavEntry {
+
+    /* The node this entry was built from (or NULL, once it has been deleted when streaming) */
+    Node* node;
+
+    /* Name, description, and section number of the node */
+    string name, desc, secnum;
+
+    /* Anchor ID of the node (see 'anchor()') */
+    string id;
+
+    /* Depth from the root */
+    int depth;
+
+    /* Index of the parent entry (or -1 for the root) */
+    int par;
+
+    /* Indexes of the children entries */
+    vector<int> sub;
+
+    /* Reference IDs that the node contains, and their anchor IDs */
+    vector<string> contains, containsid;
+
+    /* Source positions of the node and of 'contains' (see 'Node::line' and 'Node::containspos') */
+    int line, col;
+    vector<pair<int, int>> containspos;
+
+};
+
+/* Target that references can be resolved to, which is either a node or one of the IDs it contains
+ *
+ */
+struct Anchor {
+
+    /* Anchor ID */
+    string id;
+
+    /* Index of the entry in 'Project::nav' that defines it */
+    int navi;
+
+    /* Index into the entry's 'contains', or -1 if the anchor is the node itself */
+    int ci;
+
+    /* Source position (0-based line and column), or -1 if unknown */
+    int line, col;
+
+};
+
+/* Problem found in the source of a project, such as a broken reference
+ *
+ */
+struct Diagnostic {
+
+    /* Source position (0-based line and column), or -1 if unknown */
+    int line, col;
+
+    /* Message describing the problem */
+    string msg;
+
+};
+
+/* Grammar for build-time syntax highlighting of code blocks (see 'highlight()')
+ *
+ * Grammars are table-driven, so a language only gives its word lists and lexical rules. Output is wrapped
+ *   in '<span class='hljs-...'>', so the same stylesheets work as with highlight.js
+ */
+struct Grammar {
+
+    /* Name of the language */
+    string name;
+
+    /* Other names that code blocks may use for the language (as in '```ks') */
+    vector<string> aliases;
+
+    /* Map of words (identifiers, or symbols like '...') to their class, like 'keyword', 'literal', or 'built_in' */
+    unordered_map<string, string> words;
+
+    /* Words that make the next identifier a 'title' (like 'func', for function names) */
+    vector<string> titles;
+
+    /* Start of a line comment, or empty if there are none */
+    string comment;
+
+    /* String delimiters, checked in order (so, longer ones should come first) */
+    vector<string> strings;
+
+    /* Prompts that are highlighted as 'meta' when they start a line (like '>>> ') */
+    vector<string> prompts;
+
+    /* Whether object reprs ('<name' at the start of a line, and '>' at the end of one) are highlighted as 'meta' */
+    bool reprs = false;
+
+    /* Whether numbers are highlighted (including '0b', '0o', '0x', and '0d' prefixes, exponents, and an 'i' suffix) */
+    bool numbers = true;
+
+};
+
+/* Images used by a project (see '@image'), each of which is read once per build, the first time it is
+ *   needed, and then shared by all outputs. It is safe to use from multiple threads
+ */
+struct ImageCache {
+
+    /* Image file */
+    struct Image {
+
+        /* Path of the file, and its name in the output (with a hash of the contents, so it can be cached
+         *   forever), and the hash
+         */
+        string src, name;
+        uint64_t hash = 0;
+
+        /* Size in pixels, or -1 if it couldn't be read from the file */
+        int width = -1, height = -1;
+
+        /* (INTERNAL)
+         * Makes sure the file is only read once
+         */
+        once_flag once;
+
+    };
+
+    /* Images, by path */
+    map<string, Image*> images;
+
+    /* Lock for 'images' (each image is read without holding it) */
+    mutex mu;
+
+    ~ImageCache() {
+        for (map<string, Image*>::iterator it = images.begin(); it != images.end(); ++it) {
+            delete it->second;
+        }
+    }
+
+    /* Return the image at 'fname', reading it if this is the first time. Throws an error if it can't be read */
+    const Image& get(const string& fname);
+
+    /* Sets 'width' and 'height' to the size of a PNG, JPEG, GIF, or SVG image with contents 'data', and
+     *   returns whether it could be read from the header
+     */
+    static bool dimensions(const string& data, int& width, int& height);
+
+};
+
 /* Macro function definition
  *
  */
@@ -306,9 +576,18 @@ struct Macro {
  */
 struct Project {
 
-    /* The string source code the project contains */
+    /* The string source code the project contains (empty when streaming) */
     string src;
 
+    /* Source code being parsed, which is 'src' (or, when streaming, a mapping owned by the caller), and
+     *   its length
+     */
+    const char* text;
+    size_t size;
+
+    /* Whether the project is streamed (see 'stream()'), so nodes are only kept while they are output */
+    bool streaming;
+
     /* Variables in the project */
     map<string, Item*> vars;
 
@@ -318,6 +597,47 @@ struct Project {
     /* Root index page of the project */
     Node* root;
 
+    /* Navigation index, with one entry per node in pre-order (so, 'nav[0]' is the root)
+     *
+     * Built once parsing is done, and then shared by all outputs
+     */
+    vector<NavEntry> nav;
+
+    /* Every anchor in the project, and a map of anchor IDs to indexes in 'anchors'
+     *
+     * Built once parsing is done, by 'resolve()'
+     */
+    vector<Anchor> anchors;
+    unordered_map<string, int> anchormap;
+
+    /* Backlinks, in compressed sparse row form: the anchors that reference 'anchors[i]' are
+     *   'backsrc[backoff[i]]' through 'backsrc[backoff[i + 1] - 1]' (in source order, without duplicates)
+     *
+     * Built by 'resolve()'
+     */
+    vector<int> backoff, backsrc;
+
+    /* (INTERNAL)
+     * References found so far, as (source anchor, target anchor) pairs, which are turned into the
+     *   backlinks. A target of -1 means it is not known yet (see 'pending')
+     */
+    vector<pair<int, int>> edges;
+
+    /* (INTERNAL)
+     * References to anchors that weren't defined yet, when streaming, which are resolved at the end
+     */
+    struct Pending {
+        /* Index into 'edges', or -1 if the reference has no source anchor */
+        int edge;
+        /* Name being referenced, and source position */
+        string name;
+        int line, col;
+    };
+    vector<Pending> pending;
+
+    /* Problems found while building the project (broken references, duplicate anchors, etc) */
+    vector<Diagnostic> warnings;
+
     /* Current node being traversed */
     Node* cur;
 
@@ -327,9 +647,54 @@ struct Project {
     /* Number of left brackets */
     int mathlbrc;
 
+    /* Number of '```' code blocks for each language */
+    map<string, int> langs;
+
+    /* Directory that paths in the source (like those given to '@image') are relative to, ending in a '/'
+     *   (or empty, for the current directory)
+     */
+    string srcdir;
+
+    /* Images used by the project */
+    ImageCache images;
+
+    /* Returns the image at 'path' in the source (see 'srcdir') */
+    const ImageCache::Image& image(const string& path);
+
+    /* (INTERNAL)
+     * Lexer, when streaming (so only the tokens of the node being parsed are kept)
+     */
+    Lexer* lexer;
+
+    /* (INTERNAL)
+     * If set, called with each top-level node as soon as it has been parsed, after which it is deleted
+     */
+    function<void(Node*)> ontop;
+
+    /* Inventories of other projects, which references that aren't defined in this project are looked up
+     *   in (in order). These are not owned by the project
+     */
+    vector<Inventory*> inventories;
+
+    /* URLs of external targets that references resolved to (see 'Item::ext'), and a map of anchor IDs to
+     *   indexes in 'externs' (or -1 if it wasn't found in any inventory)
+     */
+    vector<string> externs;
+    unordered_map<string, int> externmap;
+
 
-    /* Construct from file source */
-    Project(const string& src_);
+    /* Construct from file source, resolving references that aren't defined in it with 'invs'
+     */
+    Project(const string& src_, const vector<Inventory*>& invs={});
+
+    /* Construct from 'size' bytes of source at 'text' (which must be followed by a NUL byte, and outlive
+     *   the project), for streaming
+     *
+     * This is for documents too large to keep parsed in memory. It only indexes the source: each top-level
+     *   node is parsed, added to 'nav' and 'anchors', and deleted, so 'root' never has any children. The
+     *   content is parsed again by 'stream()'
+     */
+    Project(const char* text_, size_t size_, const vector<Inventory*>& invs={});
 
     ~Project() {
         for (map<string, Item*>::iterator it = vars.begin(); it != vars.end(); ++it) {
@@ -341,6 +706,7 @@ struct Project {
         }
 
         delete root;
+        delete lexer;
     }
 
     /* Call '@<name>(*args)', and return the result */
@@ -352,129 +718,964 @@ struct Project {
     /* Set a key */
     void set(const string& key, Item* val);
 
+    /* Parses a streamed project again, calling 'fn' with each top-level node as soon as it has been parsed
+     *   (with references resolved, and 'navi' set), and deleting it afterwards
+     *
+     * So, at most one top-level node is in memory at a time. Content outside of any node was kept by the
+     *   constructor (in 'root->val'), and is not parsed again
+     */
+    void stream(const function<void(Node*)>& fn);
+
+    /* Computes everything that is otherwise computed (and cached) when it is first read, like 'Item::id()',
+     *   so that outputs can read the project from multiple threads at once
+     *
+     * Outputs don't modify the project, so after this it is safe to share between them (except when
+     *   streaming, since 'stream()' parses it again)
+     */
+    void freeze();
+
+    /* (INTERNAL)
+     * Sets up the builtin macros and variables
+     */
+    void setup();
+
+    /* (INTERNAL)
+     * Parses the whole source, appending content outside of any node to 'root'
+     */
+    void parse();
+
     /* (INTERNAL)
      * Parses from 'toks', and stops on seperators if 'stopsep' is given
      */
     Item* parse_text(vector<Token>& toks, int& toki, bool stopsep=false);
 
+    /* (INTERNAL)
+     * Adds 'node' and its children to 'nav', returning the index of its entry
+     */
+    int index(Node* node, int par);
+
+    /* (INTERNAL)
+     * Builds 'anchors' from 'nav', and resolves every 'REF' item, adding warnings for broken references
+     *   and duplicate anchors. Also builds the backlinks
+     */
+    void resolve();
+
+    /* (INTERNAL)
+     * Adds the anchors defined by 'nav[navi]', warning about duplicates
+     */
+    void addanchors(int navi);
+
+    /* (INTERNAL)
+     * Resolves the 'REF' items in 'val' (the content of 'nav[navi]'), and adds them to 'edges'. Those that
+     *   can't be resolved are warned about, or added to 'pending' if 'defer' is given
+     */
+    void link(Item* val, int navi, bool defer);
+
+    /* (INTERNAL)
+     * Builds 'backoff' and 'backsrc' from 'edges'
+     */
+    void backlink();
+
+    /* (INTERNAL)
+     * Returns the index in 'externs' of the anchor 'id' from another project, or -1 if it isn't in any of
+     *   'inventories'
+     */
+    int external(const string& id);
+
+    /* Returns the display name of 'anchors[i]' (the node name, or the key it contains) */
+    const string& anchorname(int i);
+
+    /* (INTERNAL)
+     * Adds a warning at the given (0-based) position
+     */
+    void warn(int line, int col, const string& msg);
+
 
 };
 
 
-/* Base class of other output types, which explains the interface
- *   for transforming 'Item*' into a project
+/* Streaming HTML minifier, which filters output as it is flushed
  *
- * The basic pattern for outputters is:
- * 
- * ```
- * Output* x = new OtherOutput(proj, dest);
- * x->init(); // Initialize output
- * x->exec(); // Execute and output all pages
- * x->fini(); // Finish and clean up
- * ```
- * 
+ * It drops comments and collapses runs of whitespace to a single space (or newline, if the run had one),
+ *   except inside '<pre>' and '<script>', which are copied verbatim. State is kept between calls, so input
+ *   may be split anywhere (even in the middle of a tag)
  */
-struct Output {
-    
-    /* The project that it is being output */
-    Project* proj;
-
-    /* The destination (may be a file or directory) */
-    string dest;
-    
-    Output(Project* proj_, const string& dest_) : proj(proj_), dest(dest_) {}
+struct Minifier {
+
+    /* What is being scanned */
+    enum State {
+        /* Text between tags */
+        TEXT,
+        /* Just after '<', collecting bytes in 'pend' until we know what it starts */
+        LT,
+        /* Inside a tag, an attribute value quoted with ', or an attribute value quoted with " */
+        TAG,
+        SQ,
+        DQ,
+        /* Inside a comment */
+        COMMENT,
+    };
+
+    /* Raw elements, in which text is not changed */
+    enum Raw {
+        NONE,
+        PRE,
+        SCRIPT,
+    };
+
+    State state = TEXT;
+    Raw raw = NONE;
+
+    /* Pending whitespace (0 for none, 1 for a space, 2 for a newline) */
+    int ws = 0;
+
+    /* Number of '-' seen in a row (in a comment) */
+    int dashes = 0;
+
+    /* Bytes after a '<' which haven't been output yet, and which tags they could still start (a bitmask) */
+    char pend[12];
+    int npend = 0, alive = 0;
+
+    /* Filter 'n' bytes of 'x' to 'res', which must have room for 'n + Minifier::SLACK' bytes, and return
+     *   the number of bytes written
+     */
+    size_t run(char* res, const char* x, size_t n);
 
-    /* Initialize for the specific output format */
-    virtual void init() = 0;
-    
-    /* Execute relevant code and output all pages */
-    virtual void exec() = 0;
+    /* Finish the input, writing anything still pending to 'res' (at most 'Minifier::SLACK' bytes), and
+     *   return the number of bytes written
+     */
+    size_t finish(char* res);
 
-    /* Finish executing and clean up resources */
-    virtual void fini() = 0;
+    /* Extra room needed for output, beyond the input size (including a 'finish()' right after) */
+    static const size_t SLACK = 2 * sizeof(pend) + 1;
 
 };
 
 
-/* Text output, which aims to output markdown-like syntax in a single file
+/* Buffered output sink, which all output backends write through
+ *
+ * Output is collected in a large contiguous buffer, and handed to the OS with 'write()' (or 'writev()', when
+ *   a large chunk arrives while the buffer is non-empty) only once it fills up. So, a typical page is
+ *   written with a few syscalls instead of one per line
  */
-struct TextOutput : public Output {
+struct Writer {
 
-    /* Output file stream */
-    ofstream fp;
+    /* Default buffer capacity (bytes) */
+    static const size_t BUFSIZE = 1 << 20;
 
-    /* Indent stack */
-    vector<string> indstk;
-    
+    /* File descriptor being written to, or -1 if not opened */
+    int fd;
 
-    TextOutput(Project* proj_, const string& dest_) : Output(proj_, dest_) {}
+    /* Buffer, number of bytes used, and capacity */
+    char* buf;
+    size_t len, cap;
 
-    /* Overrides */
-    void init();
-    void exec();
-    void fini();
+    /* Filter applied to output as it is flushed (or NULL for none), and its output buffer */
+    Minifier* filter;
+    char* fbuf;
 
-    /* (INTERNAL)
-     * apply indentation
+    /* Name of the file being written, and compressed copies being written along with it (which are
+     *   started when there is data for them)
      */
-    void ind();
+    string fname;
+    int kinds;
+    vector<Compressor*> comps;
 
-    /* (INTERNAL)
-     * Dumps an object
+    /* If given, files are rendered into memory, and only written (atomically) if they differ from the
+     *   previous build (see 'Manifest')
      */
-    template<typename T>
-    void dump(T val) {
-        fp << val;
-    }
+    Manifest* manifest;
 
-    /* (INTERNAL) 
-     * Dumps an entire item
+    /* Whether the current file is being kept in memory */
+    bool inmem;
+
+    /* If given (along with 'manifest'), changed files are handed to this queue instead of being written
+     *   right away
      */
-    void dump_item(Item* item);
+    FileQueue* files;
 
-    /* (INTERNAL) 
-     * Dumps an entire node
+    /* If set (along with 'manifest'), files are written to a temporary file as they are rendered (and
+     *   hashed as they go), instead of being kept in memory, for files too large for that. When closed, the
+     *   temporary file replaces the file if it changed, or is removed otherwise
      */
-    void dump_node(Node* node);
+    bool spool;
 
+    /* Whether the current file is being spooled, and the hash of what was written so far */
+    bool spooling;
+    uint64_t hash;
 
-};
+    Writer(size_t cap_=BUFSIZE) : fd(-1), buf((char*)malloc(cap_)), len(0), cap(cap_), filter(NULL), fbuf(NULL), kinds(0), manifest(NULL), inmem(false), files(NULL), spool(false), spooling(false), hash(0) {}
+    Writer(const Writer& other) = delete;
 
+    ~Writer() {
+        close();
+        free(buf);
+        delete filter;
+        free(fbuf);
+    }
 
-/* HTML output, which aims to output HTML syntax in a single file
- */
-struct HTMLOutput : public Output {
+    /* Minify HTML written from now on (see 'Minifier') */
+    void minify();
 
-    /* Output file stream */
-    ofstream fp;
+    /* Also write compressed copies of the file, for each kind in 'kinds' (see 'Compressor::Kind'). This
+     *   should be called right after 'open()'
+     */
+    void compress(int kinds);
 
-    /* Whether or not to respect paragraphs (use top value) */
-    vector<bool> doparastk;
+    /* Open 'fname' for writing (truncating it), throws an error if it could not be opened */
+    void open(const string& fname);
 
-    /* Whether we are currently in a paragraph */
-    bool inpara;
+    /* Flush and close the file, if one is open (or, if it is in memory, write it if it has changed) */
+    void close();
 
-    /* Whether we need to add paragraph at next opportunity */
-    bool needspara;
+    /* Write all buffered data to the file */
+    void flush();
 
-    HTMLOutput(Project* proj_, const string& dest_) : Output(proj_, dest_), inpara(false), needspara(true) {}
+    /* Write 'sz' bytes from 'data' */
+    void write(const char* data, size_t sz) {
+        if (len + sz > cap) {
+            spill(data, sz);
+        } else {
+            memcpy(buf + len, data, sz);
+            len += sz;
+        }
+    }
 
-    /* Overrides */
-    void init();
-    void exec();
-    void fini();
+    /* Write a single character */
+    void put(char c) {
+        if (len >= cap) {
+            spill(&c, 1);
+        } else {
+            buf[len++] = c;
+        }
+    }
+
+    /* Write strings */
+    void put(const char* x) {
+        write(x, strlen(x));
+    }
+    void put(const string& x) {
+        write(x.data(), x.size());
+    }
+
+    /* Write integers, in base 10 */
+    void put(int x) {
+        if (x < 0) {
+            put('-');
+            putu(-(unsigned long long)x);
+        } else {
+            putu(x);
+        }
+    }
+    void put(size_t x) {
+        putu(x);
+    }
 
     /* (INTERNAL)
-     * apply indentation
+     * Formats an unsigned integer
      */
-    void ind();
+    void putu(unsigned long long x);
 
     /* (INTERNAL)
-     * Dumps an object
+     * Handles a write that does not fit in the buffer
      */
-    template<typename T>
-    void dump(T val) {
-        fp << val;
+    void spill(const char* data, size_t sz);
+
+    /* (INTERNAL)
+     * Writes 'sz' bytes of 'data' to the file (and compressed copies)
+     */
+    void emit(const char* data, size_t sz);
+
+    /* (INTERNAL)
+     * Starts compressed copies of the current file, if any were requested
+     */
+    void startcomps();
+
+    /* (INTERNAL)
+     * Gives the last 'sz' bytes of 'data' to the compressed copies, and waits for them to finish
+     */
+    void finishcomps(const char* data, size_t sz);
+
+    /* (INTERNAL)
+     * Finishes a file that was rendered into memory
+     */
+    void closemem();
+
+    /* (INTERNAL)
+     * Finishes a file that was spooled to a temporary file
+     */
+    void closespool();
+
+};
+
+
+/* Writes a compressed copy of a file (a "sidecar", such as 'index.html.gz'), which servers can send as-is
+ *
+ * Data is compressed on a worker thread as it arrives, so compressing overlaps with rendering. If all the
+ *   data arrives at once (small files), it is compressed on the calling thread instead
+ *
+ * Each kind is only available if doq was built with the library for it (see 'makefile'), so there is no
+ *   extra dependency otherwise
+ */
+struct Compressor {
+
+    /* Kinds of compression (which may be or'd together, when a set of kinds is requested) */
+    enum Kind {
+        /* gzip, written to '.gz' (requires zlib) */
+        GZIP = 1,
+        /* Brotli, written to '.br' (requires libbrotlienc) */
+        BROTLI = 2,
+    };
+
+    Kind kind;
+
+    /* Output for the sidecar */
+    Writer out;
+
+    /* Compression state (a 'z_stream*' or 'BrotliEncoderState*') */
+    void* state;
+
+    /* Worker thread (or NULL if not started), and queued chunks (an empty chunk means the end) */
+    thread* worker;
+    mutex mu;
+    condition_variable cv;
+    deque<string> queue;
+
+    /* Error from the worker, if any */
+    string err;
+
+    /* Start a sidecar for 'fname' (which is written to 'fname' plus the extension for 'kind') */
+    Compressor(const string& fname, Kind kind);
+    Compressor(const Compressor& other) = delete;
+
+    ~Compressor();
+
+    /* Add 'sz' bytes of 'data', which is compressed on the worker thread (starting it if needed) */
+    void feed(const char* data, size_t sz);
+
+    /* Add the last 'sz' bytes, wait for everything to be compressed, and close the sidecar. Throws an error
+     *   if anything failed
+     */
+    void finish(const char* data=NULL, size_t sz=0);
+
+    /* Returns whether 'kind' is available in this build */
+    static bool supported(Kind kind);
+
+    /* Returns the file extension for 'kind' */
+    static const char* ext(Kind kind);
+
+    /* (INTERNAL)
+     * Compresses 'sz' bytes of 'data' and writes the result to the sidecar
+     */
+    void process(const char* data, size_t sz, bool last);
+
+    /* (INTERNAL)
+     * Body of the worker thread
+     */
+    void run();
+
+};
+
+
+/* Queue of whole files to write, which are written in batches to save syscalls
+ *
+ * Each file is written to a temporary file and then renamed into place. Batches are submitted with io_uring
+ *   (at most 'depth' files at a time), or written by a pool of threads if io_uring isn't available. The
+ *   results are the same either way. It is safe to use from multiple threads
+ */
+struct FileQueue {
+
+    /* File to write */
+    struct Job {
+
+        /* Where it goes, and the temporary file it's written to first */
+        string fname, tmp;
+
+        /* Contents */
+        string data;
+
+        /* File descriptor of the temporary file, and results of each operation (from io_uring) */
+        int fd;
+        ssize_t written;
+        int closed, renamed;
+
+        /* Error message, if it failed */
+        string err;
+
+    };
+
+    /* Maximum number of files in a batch */
+    size_t depth;
+
+    /* io_uring state (or NULL if threads are used), and the file descriptor of the ring */
+    void* ring;
+    int ringfd;
+
+    /* Memory shared with the kernel, and the next submission queue index */
+    void *sqmem, *cqmem;
+    size_t sqsize, cqsize, sqesize;
+    unsigned sqtail;
+
+    /* Lock for 'pending' and 'err', and lock for using the ring */
+    mutex mu, ringmu;
+
+    /* Files that haven't been submitted yet */
+    vector<Job> pending;
+
+    /* First error, which is thrown from 'wait()' */
+    string err;
+
+    /* Create a queue, using io_uring if 'uring' is given and it is available */
+    FileQueue(size_t depth=64, bool uring=true);
+    FileQueue(const FileQueue& other) = delete;
+
+    ~FileQueue();
+
+    /* Queue writing 'sz' bytes of 'data' to 'fname' (which may write a batch) */
+    void add(const string& fname, const char* data, size_t sz);
+
+    /* Write everything that's queued, and throw an error if anything failed */
+    void wait();
+
+    /* (INTERNAL)
+     * Sets up the io_uring, if possible
+     */
+    void setup();
+
+    /* (INTERNAL)
+     * Writes a batch of files
+     */
+    void run(vector<Job>& jobs);
+    void run_uring(vector<Job>& jobs);
+    void run_threads(vector<Job>& jobs);
+
+    /* (INTERNAL)
+     * Submits the 'n' entries added since the last submission, and waits for them to complete
+     */
+    void submit(unsigned n, vector<Job>& jobs);
+
+    /* (INTERNAL)
+     * Writes a file with normal syscalls
+     */
+    void finish_job(Job& job);
+
+};
+
+
+/* Record of the files written by a build, so the next build into the same directory can leave unchanged
+ *   files alone (which keeps their modification times, so tools like 'rsync' skip them), and remove files
+ *   that are no longer generated
+ *
+ * It is stored in the output directory as '.doq-manifest', with a line for each file, which has a hash of
+ *   the contents and the path relative to the output directory. It is safe to use from multiple threads
+ */
+struct Manifest {
+
+    /* Output directory */
+    string dir;
+
+    /* Hashes of files from the previous build, and from this build (by relative path) */
+    map<string, uint64_t> old, cur;
+
+    /* Lock for 'cur' and the counts */
+    mutex mu;
+
+    /* Number of files that were written, left unchanged, and removed */
+    int nwritten = 0, nsame = 0, nremoved = 0;
+
+    /* Load the manifest for 'dir', if there is one */
+    Manifest(const string& dir);
+
+    /* Record that this build generates 'fname' with contents hashing to 'hash', and return whether it needs
+     *   to be written (because it changed, is missing, or 'force' is given)
+     */
+    bool changed(const string& fname, uint64_t hash, bool force=false);
+
+    /* Remove files from the previous build that this build didn't generate (along with compressed copies),
+     *   and save the manifest
+     */
+    void finish();
+
+    /* (INTERNAL)
+     * Returns 'fname' relative to 'dir'
+     */
+    string rel(const string& fname);
+
+};
+
+
+/* Page template, which is text with named slots (like '{{title}}') that are filled in when it is output
+ *
+ * It is parsed once into segments, each of which is a span of the text followed by a slot, so outputting it
+ *   writes the spans straight from 'text' and fills in each slot in turn
+ */
+struct Template {
+
+    /* Span of 'text' ('len' bytes at 'off'), followed by the slot with ID 'slot' (or -1 for none) */
+    struct Segment {
+        size_t off, len;
+        int slot;
+    };
+
+    /* File it was read from (for messages), and its contents */
+    string fname, text;
+
+    /* Segments, in order */
+    vector<Segment> segs;
+
+    /* Names of the slots, indexed by their ID (each name only appears once) */
+    vector<string> slots;
+
+    Template() {}
+
+    /* Read and parse the template in 'fname', throws an error if a slot isn't closed */
+    Template(const string& fname_);
+
+    /* Output the template to 'fp', where 'fill[i]' is called to fill in the slot with ID 'i' */
+    void render(Writer& fp, const vector<function<void()>>& fill) const;
+
+};
+
+
+/* Inventory of the anchors in a project, and the URL of each, which other projects load to resolve their
+ *   references to it
+ *
+ * The file ('doq.inv' in the output) is mapped, not read, and looked up in place with a binary search, so
+ *   loading one takes the same time regardless of its size. It is laid out as:
+ *
+ *   char    magic[4]           ("DOQI")
+ *   uint32  version, n, strsize
+ *   uint32  ents[n][4]         (offset and length of the ID, then of the URL, in the string table, sorted
+ *                               by ID, compared bytewise)
+ *   char    strs[strsize]      (string table)
+ *
+ * Integers are 32 bit little-endian. URLs are relative to the output directory of the project
+ */
+struct Inventory {
+
+    /* File it was read from, and the URL that its URLs are relative to (prepended to them) */
+    string fname, base;
+
+    /* Mapping of the file */
+    char* data;
+    size_t size;
+
+    /* Number of entries, the entries, and the string table */
+    uint32_t n;
+    const uint32_t* ents;
+    const char* strs;
+
+    /* Map the inventory in 'fname', throws an error if it could not be read or is not an inventory */
+    Inventory(const string& fname_, const string& base_);
+    Inventory(const Inventory& other) = delete;
+
+    ~Inventory();
+
+    /* Set 'url' to the URL of 'id' (with 'base' prepended), and return whether it was found */
+    bool find(const string& id, string& url) const;
+
+    /* Write an inventory of 'ents' (pairs of IDs and URLs, which are sorted) to 'fp' */
+    static void write(Writer& fp, vector<pair<string, string>>& ents);
+
+};
+
+
+/* Full-text search index, mapping terms to the documents (anchors) that contain them
+ *
+ * Text is added while rendering, and then the index is written as shards of terms grouped by their first
+ *   two bytes, which 'assets/doq.js' loads on demand
+ */
+struct SearchIndex {
+
+    /* Occurrence of a term in a document */
+    struct Posting {
+
+        /* Document (index into 'Project::anchors') */
+        int doc;
+
+        /* Term frequency */
+        int tf;
+
+    };
+
+    /* Term and its postings */
+    typedef pair<const string, vector<Posting>> Term;
+
+    /* Map of terms (lowercase) to their postings, in the order they were added */
+    unordered_map<string, vector<Posting>> terms;
+
+    /* Temporary used by 'add()' */
+    string tmp;
+
+    /* Kinds of compressed copies to write (see 'Compressor::Kind'), and the manifest and file queue of the
+     *   build (or NULL)
+     */
+    int compress = 0;
+    Manifest* manifest = NULL;
+    FileQueue* files = NULL;
+
+    /* Tokenizes 'n' bytes of 'x' and adds the terms to 'doc' */
+    void add(int doc, const char* x, size_t n);
+
+    /* Write the index to the directory 'dir', given the ID and title of every document
+     *
+     * Shards are serialized and written in parallel
+     */
+    void write(const string& dir, const vector<pair<string, string>>& docs);
+
+    /* Returns the shard name for a term (hex of the first two bytes) */
+    static string shard(const string& term);
+
+};
+
+
+/* Base class of other output types, which explains the interface
+ *   for transforming 'Item*' into a project
+ *
+ * The basic pattern for outputters is:
+ * 
+ * ```
+ * Output* x = new OtherOutput(proj, dest);
+ * x->init(); // Initialize output
+ * x->exec(); // Execute and output all pages
+ * x->fini(); // Finish and clean up
+ * ```
+ * 
+ */
+struct Output {
+    
+    /* The project that it is being output */
+    Project* proj;
+
+    /* The destination (may be a file or directory) */
+    string dest;
+    
+    /* Files written by this build and the last one, for outputs that keep track of them (or NULL) */
+    Manifest* manifest = NULL;
+
+    Output(Project* proj_, const string& dest_) : proj(proj_), dest(dest_) {}
+
+    virtual ~Output() {
+        delete manifest;
+    }
+
+    /* Initialize for the specific output format */
+    virtual void init() = 0;
+    
+    /* Execute relevant code and output all pages */
+    virtual void exec() = 0;
+
+    /* Finish executing and clean up resources */
+    virtual void fini() = 0;
+
+};
+
+
+/* Text output, which aims to output markdown-like syntax in a single file
+ */
+struct TextOutput : public Output {
+
+    /* Output file */
+    Writer fp;
+
+    /* Indent stack, as the prefix for the current level (all the indents, concatenated), and the length of
+     *   the prefix before each level was added
+     */
+    string indent;
+    vector<size_t> indlens;
+
+    /* Whether to write one file per node, in a directory tree like the nodes, instead of a single file
+     *
+     * Pages are rendered in parallel, and references become relative links between the files
+     */
+    bool split = false;
+
+    /* When split, the file for each entry of 'proj->nav' (relative to 'dest'), and the entry being output */
+    vector<string> paths;
+    int curnavi = -1;
+
+    /* Images in the output, by their name in the output, which are copied there at the end */
+    map<string, const ImageCache::Image*> images;
+
+    TextOutput(Project* proj_, const string& dest_) : Output(proj_, dest_) {}
+
+    /* Overrides */
+    void init();
+    void exec();
+    void fini();
+
+    /* (INTERNAL)
+     * apply indentation
+     */
+    void ind();
+
+    /* (INTERNAL)
+     * Adds a level of indentation, and removes the last one
+     */
+    void pushind(const char* x);
+    void popind();
+
+    /* (INTERNAL)
+     * Dumps an object
+     */
+    template<typename T>
+    void dump(T val) {
+        fp.put(val);
+    }
+
+    /* (INTERNAL) 
+     * Dumps an entire item
+     */
+    void dump_item(Item* item);
+
+    /* (INTERNAL) 
+     * Dumps an entire node
+     */
+    void dump_node(Node* node);
+
+    /* (INTERNAL)
+     * Computes 'paths', and makes the directories for them
+     */
+    void makepaths();
+
+    /* (INTERNAL)
+     * Returns the relative link from the current page to 'anchor' (an index into 'proj->anchors')
+     */
+    string link(int anchor);
+
+    /* (INTERNAL)
+     * Writes the page for the entry 'navi' to its own file
+     */
+    void dump_page(int navi);
+
+
+};
+
+
+/* JSON output, which writes the whole tree (nodes and their content) as a single JSON document, for other
+ *   tools to consume
+ *
+ * It is written straight to the file as the tree is walked, so there is no intermediate document in memory.
+ *   Text in an item's content is merged into strings, so content is an array of strings and objects (for
+ *   other kinds of items, like '{"kind":"bold","sub":[...]}')
+ */
+struct JSONOutput : public Output {
+
+    /* Output file */
+    Writer fp;
+
+    /* If set, write NDJSON instead: one node per line, with its index in 'Project::nav' and its parent's
+     *   index (instead of nesting children)
+     */
+    bool ndjson;
+
+    /* (INTERNAL)
+     * Whether the array being written has no elements yet, and whether a string is open at its end (which
+     *   further text is appended to)
+     */
+    bool first, intext;
+
+    JSONOutput(Project* proj_, const string& dest_, bool ndjson_=false) : Output(proj_, dest_), ndjson(ndjson_), first(true), intext(false) {}
+
+    /* Overrides */
+    void init();
+    void exec();
+    void fini();
+
+    /* (INTERNAL)
+     * Dumps an object
+     */
+    template<typename T>
+    void dump(T val) {
+        fp.put(val);
+    }
+
+    /* (INTERNAL)
+     * Dumps the contents of a JSON string (escaped, but without the quotes)
+     */
+    void dump_esc(const char* data, size_t sz);
+    void dump_esc(const string& val) {
+        dump_esc(val.data(), val.size());
+    }
+
+    /* (INTERNAL)
+     * Dumps a quoted JSON string
+     */
+    void dump_str(const string& val);
+
+    /* (INTERNAL)
+     * Dumps an item's content (its text and children) as an array
+     */
+    void dump_content(Item* item);
+
+    /* (INTERNAL)
+     * Dumps the elements of an item's content into the current array
+     */
+    void dump_elems(Item* item);
+
+    /* (INTERNAL)
+     * Dumps text into the current array
+     */
+    void dump_text(const string& val);
+
+    /* (INTERNAL)
+     * Dumps an item that isn't just text, as an object in the current array
+     */
+    void dump_item(Item* item);
+
+    /* (INTERNAL)
+     * Dumps the fields of a node (without the closing brace, or its children)
+     */
+    void dump_head(Node* node);
+
+    /* (INTERNAL)
+     * Dumps an entire node, with its children
+     */
+    void dump_node(Node* node);
+
+};
+
+/* Binary output, which writes the project in the format described in 'doqb.hh', so it can be queried
+ *   without parsing it again (see 'bin::Reader')
+ *
+ * The sections are built in memory, and then written all at once
+ */
+struct BinaryOutput : public Output {
+
+    /* Output file */
+    Writer fp;
+
+    /* Sections being built */
+    vector<bin::Node> nodes;
+    vector<bin::Item> items;
+    vector<bin::Anchor> anchors;
+    vector<uint32_t> refs;
+    string strs;
+
+    /* (INTERNAL)
+     * Offsets of strings already in 'strs', so each one is only stored once
+     */
+    unordered_map<string, uint32_t> strmap;
+
+    /* (INTERNAL)
+     * Index in 'anchors' of each of 'Project::anchors' (which are sorted by ID in the file)
+     */
+    vector<uint32_t> anchori;
+
+    BinaryOutput(Project* proj_, const string& dest_) : Output(proj_, dest_) {}
+
+    /* Overrides */
+    void init();
+    void exec();
+    void fini();
+
+    /* (INTERNAL)
+     * Adds a string to the string table
+     */
+    bin::Str str(const string& val);
+
+    /* (INTERNAL)
+     * Fills in 'items[i]' from 'item', adding its children after the end of 'items'
+     */
+    void add_item(uint32_t i, Item* item);
+
+};
+
+/* HTML output, which aims to output HTML syntax in a single file
+ */
+struct HTMLOutput : public Output {
+
+    /* Output file */
+    Writer fp;
+
+    /* Whether or not to respect paragraphs (use top value) */
+    vector<bool> doparastk;
+
+    /* Whether we are currently in a paragraph */
+    bool inpara;
+
+    /* Whether we need to add paragraph at next opportunity */
+    bool needspara;
+
+    /* Rendered tables of contents, per entry of 'proj->nav' (empty if not rendered yet) */
+    vector<string> tocs;
+
+    /* Sidebar data, which is written to 'nav.js' (empty if not rendered yet) */
+    string side;
+
+    /* Whether to add a "Referenced by" list to nodes and '@cdict' entries */
+    bool backlinks = false;
+
+    /* Whether to minify the page (see 'Minifier') */
+    bool minify = false;
+
+    /* Kinds of compressed copies to write along with each file (see 'Compressor::Kind') */
+    int compress = 0;
+
+    /* Compressed copies of assets, which are written while rendering */
+    vector<Compressor*> sidecars;
+
+    /* Queue that changed files are written through (or NULL before 'init()') */
+    FileQueue* files = NULL;
+
+    /* Output names of assets (which are content-addressed, so they can be cached forever), by their name in
+     *   'assetpath'
+     */
+    map<string, string> assets;
+
+    /* Entry in 'proj->nav' of the node currently being output */
+    int curnavi = -1;
+
+    /* Images on the page, by their name in the output, which are copied there at the end */
+    map<string, const ImageCache::Image*> images;
+
+    /* Cache of highlighted code blocks, keyed on the language and code */
+    unordered_map<string, string> hlcache;
+
+    /* Cache of formulas converted to MathML, keyed on the kind and TeX (empty if the conversion failed) */
+    unordered_map<string, string> mathcache;
+
+    /* Whether any formula couldn't be converted to MathML (so MathJax is needed) */
+    bool mathfailed = false;
+
+    /* Whether to build a search index (written to 'search/' in the output) */
+    bool dosearch = false;
+
+    /* Page template (which is 'page.html' in 'assetpath', unless this is given), and the functions that fill
+     *   in each of its slots
+     */
+    string tmplpath;
+    Template page;
+    vector<function<void()>> fills;
+
+    /* Search index */
+    SearchIndex search;
+
+    /* Document (index into 'proj->anchors') that text is currently being indexed for, or -1 if none */
+    int curdoc = -1;
+
+    HTMLOutput(Project* proj_, const string& dest_) : Output(proj_, dest_), inpara(false), needspara(true) {}
+
+    ~HTMLOutput() {
+        delete files;
+    }
+
+    /* Overrides */
+    void init();
+    void exec();
+    void fini();
+
+    /* (INTERNAL)
+     * apply indentation
+     */
+    void ind();
+
+    /* (INTERNAL)
+     * Dumps an object
+     */
+    template<typename T>
+    void dump(T val) {
+        fp.put(val);
     }
 
     /* (INTERNAL)
@@ -482,8 +1683,8 @@ struct HTMLOutput : public Output {
      */
     template<typename T>
     void dumpl(T val) {
-        fp << val;
-        fp << endl;
+        fp.put(val);
+        fp.put('\n');
     }
 
     /* (INTERNAL) 
@@ -501,16 +1702,66 @@ struct HTMLOutput : public Output {
      */
     void dump_esc(const string& x);
 
-    /* (INTERNAL) 
-     * Returns the plain-ified string of 'x', which replaces spaces
-     *   and other characters with similar characters
+    /* (INTERNAL)
+     * Returns the highlighted HTML of a 'CODE' item, which must have a grammar
+     */
+    const string& highlighted(Item* item);
+
+    /* (INTERNAL)
+     * Returns the MathML of a 'MATH' or 'MATHBLOCK' item, or an empty string if it couldn't be converted
      */
-    string plain(const string& x);
+    const string& mathml(Item* item);
 
     /* (INTERNAL)
-     * Generate sidebar contents for 'node'
+     * Converts all formulas in the project, and returns whether any need MathJax (i.e. couldn't be converted)
      */
-    void sidebar(Node* node);
+    bool needmathjax();
+
+    /* (INTERNAL)
+     * Dumps the scripts that load MathJax
+     */
+    void dump_mathjax();
+
+    /* (INTERNAL)
+     * Returns the function that fills in the slot 'name' of the page template, throws an error if there
+     *   is no such slot
+     */
+    function<void()> filler(const string& name);
+
+    /* (INTERNAL)
+     * Dumps the content of the page (all of the nodes)
+     */
+    void dump_content();
+
+    /* (INTERNAL)
+     * Returns the table of contents for the entry 'navi', rendering it if needed
+     *
+     * If the entry is at the top level, the table of contents is for the entire tree
+     */
+    const string& toc(int navi);
+
+    /* (INTERNAL)
+     * Returns the anchor index of a dictionary key, if it is one of the IDs the current node contains, or -1
+     */
+    int entryanchor(Item* key);
+
+    /* (INTERNAL)
+     * Dumps the "Referenced by" list for 'anchor' (an index into 'proj->anchors'), if it has any
+     */
+    void dump_backlinks(int anchor);
+
+    /* (INTERNAL)
+     * Returns the sidebar data (the script written to 'nav.js'), rendering it if needed
+     *
+     * The sidebar is not part of the page itself. Instead, 'doq.js' builds it from this data, and only
+     *   creates elements for the rows that are scrolled into view
+     */
+    const string& sidebar();
+
+    /* (INTERNAL)
+     * Renders a table of contents for the entry 'navi' to 'res'
+     */
+    void render_toc(string& res, int navi, bool recurse);
 
 
 };
@@ -520,14 +1771,70 @@ struct HTMLOutput : public Output {
  */
 string readall(const string& fname);
 
+/* Maps an entire file into memory (read-only), setting 'size' to its length, and returns it. The contents
+ *   are followed by a NUL byte, like a 'string'
+ *
+ * Pages are read from the file as they are used, and can be dropped again by the OS, so this works for
+ *   files larger than memory. Free it with 'unmapall()'
+ */
+char* mapall(const string& fname, size_t& size);
+
+/* Unmaps a file mapped by 'mapall()'
+ */
+void unmapall(char* data, size_t size);
+
 /* Turns 'src' into a vector of tokens
  */
 vector<Token> tokenize(const string& src);
 
 
-/* Copies a file
+/* Copies a file, unless 'dest' already has the same contents, and returns whether it was copied
+ *
+ * Uses a reflink or 'copy_file_range()' where possible, so the data doesn't pass through userspace
+ */
+bool copyfile(const string& dest, const string& src);
+
+/* Returns a 64-bit hash of 'n' bytes of 'x' (FNV-1a, which is fast, but not cryptographic)
+ *
+ * To hash data in pieces, pass the hash of the previous pieces as 'h'
+ */
+uint64_t hash64(const char* x, size_t n, uint64_t h=0xcbf29ce484222325ULL);
+
+/* Returns the content-addressed name for a file named 'fname' with contents 'data', which has a hash of
+ *   the contents before the extension (for example, 'doq.css' becomes 'doq.3f9a1c07.css')
+ */
+string hashname(const string& fname, const string& data);
+
+/* Appends 'n' bytes of 'x', HTML-escaped, to 'res'
+ */
+void htmlesc(string& res, const char* x, size_t n);
+
+/* Registers a grammar under its name and aliases (the registry takes ownership)
+ */
+void add_grammar(Grammar* g);
+
+/* Returns the grammar registered for 'lang', or NULL if there is none
+ */
+Grammar* get_grammar(const string& lang);
+
+/* Appends 'code', highlighted with 'g' and HTML-escaped, to 'res'
  */
-void copyfile(const string& dest, const string& src);
+void highlight(string& res, Grammar* g, const string& code);
+
+/* Appends the MathML for the TeX formula 'tex' to 'res', and returns whether it succeeded
+ *
+ * Only a subset of TeX is supported (see 'src/mathml.cc'). If it fails, 'res' is left unchanged
+ */
+bool tex2mathml(string& res, const string& tex, bool block);
+
+/* Appends 'x' as a JSON string literal (with quotes) to 'res'
+ */
+void jsonstr(string& res, const string& x);
+
+/* Returns the anchor ID for a name or key, which replaces spaces and cuts off at special characters
+ *   (for example, 'list.push(x)' becomes 'list.push')
+ */
+string anchor(const string& x);
 
 
 /** Builtin Macros **/
@@ -611,6 +1918,13 @@ Item* url(Project* proj, const vector<Item*>& args);
  */
 Item* ref(Project* proj, const vector<Item*>& args);
 
+/* @image <path>
+ * @image <path>, <alt text>...
+ * 
+ * Creates an image (the path is relative to the source file), which is copied to the output
+ */
+Item* image(Project* proj, const vector<Item*>& args);
+
 
 /* @list <items>...
  *
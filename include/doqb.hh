@@ -0,0 +1,282 @@
+/* doqb.hh - the binary document format written by 'doq --formats bin', and a reader for it
+ *
+ * This header doesn't depend on the rest of doq, so other programs can include it by itself to query a
+ *   built project without parsing anything. The reader maps the file, checks the header, and then reads
+ *   everything in place, so opening a file takes the same time regardless of its size
+ *
+ * The file ('index.doqb') is laid out as:
+ *
+ *   Header                         (see 'Header', at offset 0)
+ *   Node    nodes[nnodes]          (in pre-order, so 'nodes[0]' is the root)
+ *   Item    items[nitems]          (the children of an item are contiguous)
+ *   Anchor  anchors[nanchors]      (sorted by ID, compared bytewise, for binary search)
+ *   uint32  refs[nrefs]            (lists of node and anchor indexes, which records refer to by range)
+ *   char    strs[strsize]          (string table, which 'Str' values point into, not NUL-terminated)
+ *
+ * Integers are 32 bit little-endian, sections are 4-byte aligned, and indexes that aren't set are 'NONE'.
+ *   Since offsets are 32 bit, files are limited to 4GB
+ *
+ * @author: Cade Brown <cade@kscript.org>
+ */
+
+#pragma once
+#ifndef DOQB_HH__
+#define DOQB_HH__
+
+/* C std */
+#include <stdint.h>
+#include <string.h>
+
+/* POSIX */
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+/* STL */
+#include <string>
+#include <string_view>
+#include <stdexcept>
+
+namespace doq {
+namespace bin {
+
+/* Magic bytes and version, at the start of the file */
+static const char MAGIC[4] = { 'D', 'O', 'Q', 'B' };
+static const uint32_t VERSION = 1;
+
+/* Index that isn't set */
+static const uint32_t NONE = 0xFFFFFFFF;
+
+/* Kinds of items (the same as 'doq::Item::Kind') */
+enum Kind {
+    JOIN,
+    MATH,
+    MONO,
+    MONOI,
+    BOLD,
+    ITALIC,
+    UNDERLINE,
+    REF,
+    URL,
+    CODE,
+    MATHBLOCK,
+    NOTE,
+    LIST,
+    DICT,
+    IMAGE,
+};
+
+/* String, as a range of the string table */
+struct Str {
+    uint32_t off, len;
+};
+
+/* Start of the file, with the size and offset (in bytes, from the start of the file) of each section */
+struct Header {
+
+    char magic[4];
+    uint32_t version;
+
+    uint32_t nnodes, nitems, nanchors, nrefs, strsize;
+    uint32_t nodes, items, anchors, refs, strs;
+
+    /* Name of the project */
+    Str project;
+
+};
+
+/* Node (page) of the project */
+struct Node {
+
+    /* Name, anchor ID, description, and section number */
+    Str name, id, desc, secnum;
+
+    /* Depth from the root, and the index of the parent (or 'NONE' for the root) */
+    uint32_t depth, parent;
+
+    /* Index of the item with the content of the node */
+    uint32_t content;
+
+    /* Children, as node indexes in 'refs[sub]' through 'refs[sub + nsub - 1]' */
+    uint32_t sub, nsub;
+
+    /* Anchors defined in the node's content, as anchor indexes in 'refs' */
+    uint32_t contains, ncontains;
+
+};
+
+/* Item of content (see 'doq::Item') */
+struct Item {
+
+    /* What kind of item it is (see 'Kind') */
+    uint32_t kind;
+
+    /* For 'REF' items, the index of the anchor being referenced, or 'NONE' if it couldn't be resolved */
+    uint32_t target;
+
+    /* String value */
+    Str sval;
+
+    /* Children, which are 'items[sub]' through 'items[sub + nsub - 1]' */
+    uint32_t sub, nsub;
+
+};
+
+/* Target that references can be resolved to (see 'doq::Anchor') */
+struct Anchor {
+
+    /* Anchor ID */
+    Str id;
+
+    /* Index of the node that defines it, and the index within that node's 'contains' (or 'NONE' if the
+     *   anchor is the node itself)
+     */
+    uint32_t node, ci;
+
+    /* Backlinks, as the indexes of the anchors that reference this one, in 'refs' */
+    uint32_t back, nback;
+
+};
+
+/* Reader for a binary document, which maps the file and reads it in place
+ *
+ * Records are returned as references into the mapping, so they are only valid until the reader is
+ *   closed. Only the header and the section bounds are checked when opening; the ranges in records are
+ *   assumed to be valid (as written by doq)
+ */
+struct Reader {
+
+    /* Mapping of the file */
+    const char* base;
+    size_t size;
+
+    /* Header, and the sections */
+    const Header* hdr;
+    const Node* nodes;
+    const Item* items;
+    const Anchor* anchors;
+    const uint32_t* refs;
+    const char* strs;
+
+    Reader() : base(NULL), size(0), hdr(NULL), nodes(NULL), items(NULL), anchors(NULL), refs(NULL), strs(NULL) {}
+    Reader(const std::string& fname) : Reader() {
+        open(fname);
+    }
+    Reader(const Reader& other) = delete;
+
+    ~Reader() {
+        close();
+    }
+
+    /* Open 'fname', throws an error if it could not be read or is not a binary document */
+    void open(const std::string& fname) {
+        close();
+        int fd = ::open(fname.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to open file: '" + fname + "'");
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(Header)) {
+            ::close(fd);
+            throw std::runtime_error("Not a doq binary document: '" + fname + "'");
+        }
+        size = st.st_size;
+        void* p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) {
+            size = 0;
+            throw std::runtime_error("Failed to map file: '" + fname + "'");
+        }
+        base = (const char*)p;
+
+        hdr = (const Header*)base;
+        if (memcmp(hdr->magic, MAGIC, sizeof(MAGIC)) != 0 || hdr->version != VERSION
+            || !fits(hdr->nodes, hdr->nnodes, sizeof(Node)) || !fits(hdr->items, hdr->nitems, sizeof(Item))
+            || !fits(hdr->anchors, hdr->nanchors, sizeof(Anchor)) || !fits(hdr->refs, hdr->nrefs, sizeof(uint32_t))
+            || !fits(hdr->strs, hdr->strsize, 1) || hdr->nnodes == 0) {
+            close();
+            throw std::runtime_error("Not a doq binary document (or a different version): '" + fname + "'");
+        }
+        nodes = (const Node*)(base + hdr->nodes);
+        items = (const Item*)(base + hdr->items);
+        anchors = (const Anchor*)(base + hdr->anchors);
+        refs = (const uint32_t*)(base + hdr->refs);
+        strs = base + hdr->strs;
+    }
+
+    /* Unmap the file, if one is open */
+    void close() {
+        if (base) {
+            munmap((void*)base, size);
+        }
+        base = NULL;
+        size = 0;
+        hdr = NULL;
+    }
+
+    /* Returns the string 's' */
+    std::string_view str(Str s) const {
+        return std::string_view(strs + s.off, s.len);
+    }
+
+    /* Returns the name of the project */
+    std::string_view project() const {
+        return str(hdr->project);
+    }
+
+    /* Returns the number of records of each kind */
+    uint32_t nnodes() const {
+        return hdr->nnodes;
+    }
+    uint32_t nitems() const {
+        return hdr->nitems;
+    }
+    uint32_t nanchors() const {
+        return hdr->nanchors;
+    }
+
+    /* Returns the index of the anchor 'id', or 'NONE' if there is no such anchor */
+    uint32_t find(std::string_view id) const {
+        uint32_t lo = 0, hi = hdr->nanchors;
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            int c = str(anchors[mid].id).compare(id);
+            if (c == 0) return mid;
+            if (c < 0) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return NONE;
+    }
+
+    /* Returns the node that defines the anchor 'id', or NULL if there is no such anchor */
+    const Node* lookup(std::string_view id) const {
+        uint32_t i = find(id);
+        return i == NONE ? NULL : &nodes[anchors[i].node];
+    }
+
+    /* Append the text of 'items[i]' (and its children) to 'res' */
+    void flatten(uint32_t i, std::string& res) const {
+        const Item& it = items[i];
+        res.append(strs + it.sval.off, it.sval.len);
+        for (uint32_t j = 0; j < it.nsub; ++j) {
+            flatten(it.sub + j, res);
+        }
+    }
+
+    /* (INTERNAL)
+     * Whether a section of 'n' records of size 'sz' at 'off' is within the file (and aligned)
+     */
+    bool fits(uint32_t off, uint32_t n, size_t sz) const {
+        return (sz == 1 || off % 4 == 0) && off >= sizeof(Header) && (uint64_t)off + (uint64_t)n * sz <= size;
+    }
+
+};
+
+}
+}
+
+#endif /* DOQB_HH__ */
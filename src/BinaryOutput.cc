@@ -0,0 +1,129 @@
+/* BinaryOutput.cc - implementation of the 'BinaryOutput' class
+ *
+ * See 'doqb.hh' for the format. Nodes are written in the same order as 'Project::nav', and items are laid
+ *   out so each item's children are contiguous (they are reserved together, then each one is filled in)
+ *
+ * @author: Cade Brown <cade@kscript.org>
+ */
+
+#include <doq.hh>
+
+namespace doq {
+
+static_assert((int)bin::IMAGE == (int)Item::Kind::IMAGE, "'bin::Kind' must match 'Item::Kind'");
+
+bin::Str BinaryOutput::str(const string& val) {
+    if (val.size() == 0) return { 0, 0 };
+    pair<unordered_map<string, uint32_t>::iterator, bool> it = strmap.insert(make_pair(val, (uint32_t)strs.size()));
+    if (it.second) {
+        strs += val;
+    }
+    return { it.first->second, (uint32_t)val.size() };
+}
+
+void BinaryOutput::add_item(uint32_t i, Item* item) {
+    uint32_t sub = items.size(), nsub = item->sub.size();
+    items.resize(sub + nsub);
+    items[i] = { (uint32_t)item->kind, item->target >= 0 ? anchori[item->target] : bin::NONE, str(item->sval), sub, nsub };
+    for (uint32_t j = 0; j < nsub; ++j) {
+        add_item(sub + j, item->sub[j]);
+    }
+}
+
+void BinaryOutput::init() {
+    mkdir(dest.c_str(), 0777);
+    fp.open(dest + "/index.doqb");
+}
+
+void BinaryOutput::exec() {
+    /* Anchors, sorted by ID */
+    vector<uint32_t> order(proj->anchors.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+        return proj->anchors[a].id < proj->anchors[b].id;
+    });
+    anchori.resize(order.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        anchori[order[i]] = i;
+    }
+
+    /* Anchors defined in each node, by their index in the file */
+    vector<vector<uint32_t>> contains(proj->nav.size());
+    for (size_t i = 0; i < proj->anchors.size(); ++i) {
+        if (proj->anchors[i].ci >= 0) {
+            contains[proj->anchors[i].navi].push_back(anchori[i]);
+        }
+    }
+
+    for (size_t i = 0; i < order.size(); ++i) {
+        const Anchor& a = proj->anchors[order[i]];
+        uint32_t back = refs.size();
+        if (proj->backoff.size() > 0) {
+            for (int j = proj->backoff[order[i]]; j < proj->backoff[order[i] + 1]; ++j) {
+                refs.push_back(anchori[proj->backsrc[j]]);
+            }
+        }
+        anchors.push_back({ str(a.id), (uint32_t)a.navi, a.ci >= 0 ? (uint32_t)a.ci : bin::NONE, back, (uint32_t)(refs.size() - back) });
+    }
+
+    for (size_t i = 0; i < proj->nav.size(); ++i) {
+        const NavEntry& e = proj->nav[i];
+        if (!e.node) {
+            throw runtime_error("The 'bin' format can't be written when streaming");
+        }
+        bin::Node node = { str(e.name), str(e.id), str(e.desc), str(e.secnum), (uint32_t)e.depth, e.par >= 0 ? (uint32_t)e.par : bin::NONE };
+
+        node.content = items.size();
+        items.push_back({});
+        add_item(node.content, e.node->val);
+
+        node.sub = refs.size();
+        node.nsub = e.sub.size();
+        refs.insert(refs.end(), e.sub.begin(), e.sub.end());
+        node.contains = refs.size();
+        node.ncontains = contains[i].size();
+        refs.insert(refs.end(), contains[i].begin(), contains[i].end());
+        nodes.push_back(node);
+    }
+
+    /* Sections are laid out in order, after the header */
+    bin::Header hdr;
+    memcpy(hdr.magic, bin::MAGIC, sizeof(hdr.magic));
+    hdr.version = bin::VERSION;
+    hdr.project = str(proj->get("project")->flatten());
+    hdr.nnodes = nodes.size();
+    hdr.nitems = items.size();
+    hdr.nanchors = anchors.size();
+    hdr.nrefs = refs.size();
+    hdr.strsize = strs.size();
+
+    uint64_t off = sizeof(hdr);
+    hdr.nodes = off;
+    off += nodes.size() * sizeof(bin::Node);
+    hdr.items = off;
+    off += items.size() * sizeof(bin::Item);
+    hdr.anchors = off;
+    off += anchors.size() * sizeof(bin::Anchor);
+    hdr.refs = off;
+    off += refs.size() * sizeof(uint32_t);
+    hdr.strs = off;
+    off += strs.size();
+    if (off > UINT32_MAX) {
+        throw runtime_error("Project is too large for the 'bin' format (which is limited to 4GB)");
+    }
+
+    fp.write((const char*)&hdr, sizeof(hdr));
+    fp.write((const char*)nodes.data(), nodes.size() * sizeof(bin::Node));
+    fp.write((const char*)items.data(), items.size() * sizeof(bin::Item));
+    fp.write((const char*)anchors.data(), anchors.size() * sizeof(bin::Anchor));
+    fp.write((const char*)refs.data(), refs.size() * sizeof(uint32_t));
+    fp.write(strs.data(), strs.size());
+}
+
+void BinaryOutput::fini() {
+    fp.close();
+}
+
+}
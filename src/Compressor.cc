@@ -0,0 +1,187 @@
+/* Compressor.cc - implementation of the 'doq::Compressor' type
+ *
+ * Compression libraries are optional, and only used if doq was built with them ('make ZLIB=1 BROTLI=1'),
+ *   which defines 'DOQ_ZLIB' and 'DOQ_BROTLI'
+ *
+ * @author: Cade Brown <cade@kscript.org>
+ */
+
+#include <doq.hh>
+
+#ifdef DOQ_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef DOQ_BROTLI
+#include <brotli/encode.h>
+#endif
+
+namespace doq {
+
+/* Size of the buffer compressed data is produced into */
+static const size_t OUTSIZE = 1 << 16;
+
+
+Compressor::Compressor(const string& fname, Kind kind_) : kind(kind_), state(NULL), worker(NULL) {
+    if (!supported(kind)) {
+        throw runtime_error((string)"Compression to '" + ext(kind) + "' is not available in this build of doq");
+    }
+
+#ifdef DOQ_ZLIB
+    if (kind == GZIP) {
+        z_stream* z = new z_stream();
+        /* Maximum compression, with a gzip header (that's what the '16' means) */
+        if (deflateInit2(z, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+            delete z;
+            throw runtime_error("Failed to initialize zlib");
+        }
+        state = z;
+    }
+#endif
+#ifdef DOQ_BROTLI
+    if (kind == BROTLI) {
+        BrotliEncoderState* b = BrotliEncoderCreateInstance(NULL, NULL, NULL);
+        if (!b) {
+            throw runtime_error("Failed to initialize Brotli");
+        }
+        BrotliEncoderSetParameter(b, BROTLI_PARAM_QUALITY, BROTLI_MAX_QUALITY);
+        BrotliEncoderSetParameter(b, BROTLI_PARAM_MODE, BROTLI_MODE_TEXT);
+        state = b;
+    }
+#endif
+
+    out.open(fname + ext(kind));
+}
+
+Compressor::~Compressor() {
+    if (worker) {
+        /* Stopped early (because of an error), so just let the worker finish */
+        {
+            lock_guard<mutex> lock(mu);
+            queue.push_back(string());
+        }
+        cv.notify_one();
+        worker->join();
+        delete worker;
+    }
+
+#ifdef DOQ_ZLIB
+    if (kind == GZIP && state) {
+        deflateEnd((z_stream*)state);
+        delete (z_stream*)state;
+    }
+#endif
+#ifdef DOQ_BROTLI
+    if (kind == BROTLI && state) {
+        BrotliEncoderDestroyInstance((BrotliEncoderState*)state);
+    }
+#endif
+}
+
+bool Compressor::supported(Kind kind) {
+#ifdef DOQ_ZLIB
+    if (kind == GZIP) return true;
+#endif
+#ifdef DOQ_BROTLI
+    if (kind == BROTLI) return true;
+#endif
+    return false;
+}
+
+const char* Compressor::ext(Kind kind) {
+    return kind == GZIP ? ".gz" : ".br";
+}
+
+void Compressor::feed(const char* data, size_t sz) {
+    if (sz == 0) return;
+    if (!worker) {
+        worker = new thread(&Compressor::run, this);
+    }
+    {
+        lock_guard<mutex> lock(mu);
+        queue.push_back(string(data, sz));
+    }
+    cv.notify_one();
+}
+
+void Compressor::finish(const char* data, size_t sz) {
+    if (worker) {
+        {
+            lock_guard<mutex> lock(mu);
+            if (sz > 0) queue.push_back(string(data, sz));
+            queue.push_back(string());
+        }
+        cv.notify_one();
+        worker->join();
+        delete worker;
+        worker = NULL;
+    } else {
+        /* Everything arrived at once, so there's nothing to overlap with */
+        process(data, sz, true);
+    }
+
+    out.close();
+    if (err.size() > 0) {
+        throw runtime_error(err);
+    }
+}
+
+void Compressor::run() {
+    while (true) {
+        string chunk;
+        {
+            unique_lock<mutex> lock(mu);
+            cv.wait(lock, [this]() { return queue.size() > 0; });
+            chunk.swap(queue.front());
+            queue.pop_front();
+        }
+
+        bool last = chunk.size() == 0;
+        if (err.size() == 0) {
+            try {
+                process(chunk.data(), chunk.size(), last);
+            } catch (exception& e) {
+                err = e.what();
+            }
+        }
+        if (last) break;
+    }
+}
+
+void Compressor::process(const char* data, size_t sz, bool last) {
+    unsigned char res[OUTSIZE];
+
+#ifdef DOQ_ZLIB
+    if (kind == GZIP) {
+        z_stream* z = (z_stream*)state;
+        z->next_in = (Bytef*)data;
+        z->avail_in = sz;
+        do {
+            z->next_out = res;
+            z->avail_out = sizeof(res);
+            if (deflate(z, last ? Z_FINISH : Z_NO_FLUSH) == Z_STREAM_ERROR) {
+                throw runtime_error("Failed to compress with zlib");
+            }
+            out.write((const char*)res, sizeof(res) - z->avail_out);
+        } while (z->avail_out == 0);
+    }
+#endif
+#ifdef DOQ_BROTLI
+    if (kind == BROTLI) {
+        BrotliEncoderState* b = (BrotliEncoderState*)state;
+        const uint8_t* nin = (const uint8_t*)data;
+        size_t ain = sz;
+        while (true) {
+            uint8_t* nout = res;
+            size_t aout = sizeof(res);
+            if (!BrotliEncoderCompressStream(b, last ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_PROCESS, &ain, &nin, &aout, &nout, NULL)) {
+                throw runtime_error("Failed to compress with Brotli");
+            }
+            out.write((const char*)res, nout - res);
+            if (ain == 0 && !BrotliEncoderHasMoreOutput(b) && (!last || BrotliEncoderIsFinished(b))) break;
+        }
+    }
+#endif
+}
+
+}
@@ -0,0 +1,345 @@
+/* FileQueue.cc - implementation of the 'doq::FileQueue' type
+ *
+ * With io_uring, each batch takes three round trips to the kernel no matter how many files it has: one to
+ *   open every temporary file, one to write them all, and one to close and rename them all (the close and
+ *   rename of a file are linked, so the rename only happens after a successful close). If an operation
+ *   fails or isn't supported by the kernel, it is retried with a normal syscall, so the result is always
+ *   the same as the thread pool fallback
+ *
+ * The ring is set up with raw syscalls, so liburing isn't needed
+ *
+ * @author: Cade Brown <cade@kscript.org>
+ */
+
+#include <doq.hh>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+namespace doq {
+
+/* Ring pointers, into the memory shared with the kernel */
+struct Ring {
+    unsigned *sqtail, *sqmask, *sqarray;
+    unsigned *cqhead, *cqtail, *cqmask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+};
+
+/* Operations, stored in the low bits of 'user_data' (the job index is in the rest) */
+enum {
+    OP_OPEN = 0,
+    OP_WRITE,
+    OP_CLOSE,
+    OP_RENAME,
+};
+
+/* Open flags for temporary files */
+static const int OPENFLAGS = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+
+/* Write all of 'sz' bytes of 'data' at offset 'off' in 'fd' */
+static bool pwriteall(int fd, const char* data, size_t sz, off_t off) {
+    while (sz > 0) {
+        ssize_t rc = pwrite(fd, data, sz, off);
+        if (rc < 0 && errno == EINTR) continue;
+        if (rc < 0) return false;
+        data += rc;
+        sz -= rc;
+        off += rc;
+    }
+    return true;
+}
+
+/* Return the error message for a job that failed at 'what' with 'err' (an errno value) */
+static string failure(const FileQueue::Job& job, const char* what, int err) {
+    return (string)"Failed to " + what + " '" + job.fname + "': " + strerror(err);
+}
+
+
+FileQueue::FileQueue(size_t depth_, bool uring) : depth(depth_), ring(NULL), ringfd(-1) {
+    if (uring) {
+        setup();
+    }
+}
+
+FileQueue::~FileQueue() {
+    if (ring) {
+        munmap(sqmem, sqsize);
+        if (cqmem != sqmem) munmap(cqmem, cqsize);
+        munmap(((Ring*)ring)->sqes, sqesize);
+        delete (Ring*)ring;
+    }
+    if (ringfd >= 0) {
+        ::close(ringfd);
+    }
+}
+
+void FileQueue::setup() {
+    /* Each job in a batch needs at most 2 entries at once (close and rename) */
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = syscall(__NR_io_uring_setup, (unsigned)(2 * depth), &p);
+    if (fd < 0) {
+        /* Not available (old kernel, or disabled), so use threads */
+        return;
+    }
+
+    sqsize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqsize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    sqesize = p.sq_entries * sizeof(struct io_uring_sqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+        sqsize = cqsize = max(sqsize, cqsize);
+    }
+
+    sqmem = mmap(NULL, sqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    cqmem = single ? sqmem : mmap(NULL, cqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    void* sqes = mmap(NULL, sqesize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqmem == MAP_FAILED || cqmem == MAP_FAILED || sqes == MAP_FAILED) {
+        if (sqmem != MAP_FAILED) munmap(sqmem, sqsize);
+        if (cqmem != MAP_FAILED && cqmem != sqmem) munmap(cqmem, cqsize);
+        if (sqes != MAP_FAILED) munmap(sqes, sqesize);
+        ::close(fd);
+        return;
+    }
+
+    Ring* r = new Ring();
+    r->sqtail = (unsigned*)((char*)sqmem + p.sq_off.tail);
+    r->sqmask = (unsigned*)((char*)sqmem + p.sq_off.ring_mask);
+    r->sqarray = (unsigned*)((char*)sqmem + p.sq_off.array);
+    r->cqhead = (unsigned*)((char*)cqmem + p.cq_off.head);
+    r->cqtail = (unsigned*)((char*)cqmem + p.cq_off.tail);
+    r->cqmask = (unsigned*)((char*)cqmem + p.cq_off.ring_mask);
+    r->sqes = (struct io_uring_sqe*)sqes;
+    r->cqes = (struct io_uring_cqe*)((char*)cqmem + p.cq_off.cqes);
+
+    ring = r;
+    ringfd = fd;
+}
+
+void FileQueue::add(const string& fname, const char* data, size_t sz) {
+    vector<Job> batch;
+    {
+        lock_guard<mutex> lock(mu);
+        pending.push_back(Job());
+        Job& job = pending.back();
+        job.fname = fname;
+        job.data.assign(data, sz);
+        if (pending.size() >= depth) {
+            batch.swap(pending);
+        }
+    }
+    if (batch.size() > 0) {
+        run(batch);
+    }
+}
+
+void FileQueue::wait() {
+    vector<Job> batch;
+    {
+        lock_guard<mutex> lock(mu);
+        batch.swap(pending);
+    }
+    if (batch.size() > 0) {
+        run(batch);
+    }
+
+    lock_guard<mutex> lock(mu);
+    if (err.size() > 0) {
+        string e = err;
+        err = "";
+        throw runtime_error(e);
+    }
+}
+
+void FileQueue::run(vector<Job>& jobs) {
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        jobs[i].tmp = jobs[i].fname + ".doq-tmp";
+        jobs[i].fd = -1;
+    }
+
+    if (ring) {
+        /* The ring can only be used by one batch at a time */
+        lock_guard<mutex> lock(ringmu);
+        run_uring(jobs);
+    } else {
+        run_threads(jobs);
+    }
+
+    lock_guard<mutex> lock(mu);
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        if (jobs[i].err.size() > 0 && err.size() == 0) {
+            err = jobs[i].err;
+        }
+    }
+}
+
+void FileQueue::finish_job(Job& job) {
+    if (job.fd < 0) {
+        job.fd = ::open(job.tmp.c_str(), OPENFLAGS, 0666);
+        if (job.fd < 0) {
+            job.err = failure(job, "write", errno);
+            return;
+        }
+    }
+    if (!pwriteall(job.fd, job.data.data(), job.data.size(), 0)) {
+        job.err = failure(job, "write", errno);
+    }
+    if (::close(job.fd) != 0 && job.err.size() == 0) {
+        job.err = failure(job, "write", errno);
+    }
+    job.fd = -1;
+    if (job.err.size() > 0) {
+        unlink(job.tmp.c_str());
+    } else if (rename(job.tmp.c_str(), job.fname.c_str()) != 0) {
+        job.err = failure(job, "rename", errno);
+        unlink(job.tmp.c_str());
+    }
+}
+
+void FileQueue::run_threads(vector<Job>& jobs) {
+    /* Each thread takes every 'nt'th job */
+    int nt = max(1, min((int)thread::hardware_concurrency(), (int)jobs.size()));
+    vector<thread> threads;
+    for (int t = 0; t < nt; ++t) {
+        threads.push_back(thread([&, t]() {
+            for (size_t i = t; i < jobs.size(); i += nt) {
+                finish_job(jobs[i]);
+            }
+        }));
+    }
+    for (int t = 0; t < nt; ++t) {
+        threads[t].join();
+    }
+}
+
+/* Add an entry to the submission queue (the caller makes sure there is room) */
+static struct io_uring_sqe* sqe_get(Ring* r, unsigned& tail) {
+    unsigned idx = tail & *r->sqmask;
+    struct io_uring_sqe* sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sqarray[idx] = idx;
+    tail++;
+    return sqe;
+}
+
+void FileQueue::submit(unsigned n, vector<Job>& jobs) {
+    Ring* r = (Ring*)ring;
+    __atomic_store_n(r->sqtail, sqtail, __ATOMIC_RELEASE);
+
+    unsigned done = 0;
+    unsigned tosubmit = n;
+    while (done < n) {
+        int rc = syscall(__NR_io_uring_enter, ringfd, tosubmit, n - done, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            throw runtime_error((string)"Failed to submit writes: " + strerror(errno));
+        }
+        tosubmit -= min((unsigned)rc, tosubmit);
+
+        /* Handle completions */
+        unsigned head = *r->cqhead, tail = __atomic_load_n(r->cqtail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe* cqe = &r->cqes[head & *r->cqmask];
+            Job& job = jobs[cqe->user_data >> 2];
+            int op = cqe->user_data & 3, res = cqe->res;
+            if (op == OP_OPEN) {
+                job.fd = res;
+            } else if (op == OP_WRITE) {
+                job.written = res;
+            } else if (op == OP_CLOSE) {
+                job.closed = res;
+            } else {
+                job.renamed = res;
+            }
+            head++;
+            done++;
+        }
+        __atomic_store_n(r->cqhead, head, __ATOMIC_RELEASE);
+    }
+}
+
+void FileQueue::run_uring(vector<Job>& jobs) {
+    Ring* r = (Ring*)ring;
+    sqtail = *r->sqtail;
+
+    /* Round 1: open every temporary file */
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        struct io_uring_sqe* sqe = sqe_get(r, sqtail);
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uint64_t)jobs[i].tmp.c_str();
+        sqe->len = 0666;
+        sqe->open_flags = OPENFLAGS;
+        sqe->user_data = (i << 2) | OP_OPEN;
+    }
+    submit(jobs.size(), jobs);
+
+    /* Round 2: write them */
+    unsigned n = 0;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        Job& job = jobs[i];
+        job.written = -1;
+        if (job.fd < 0) continue;
+        if (job.data.size() > 0x7FFFF000) continue;
+        struct io_uring_sqe* sqe = sqe_get(r, sqtail);
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = job.fd;
+        sqe->addr = (uint64_t)job.data.data();
+        sqe->len = job.data.size();
+        sqe->off = 0;
+        sqe->user_data = (i << 2) | OP_WRITE;
+        n++;
+    }
+    submit(n, jobs);
+
+    /* Round 3: close and rename them (or finish normally, if anything went wrong) */
+    n = 0;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        Job& job = jobs[i];
+        job.closed = job.renamed = -1;
+        if (job.fd < 0 || job.written != (ssize_t)job.data.size()) {
+            if (job.fd >= 0) {
+                /* Short or failed write, so start over normally */
+                ::close(job.fd);
+                job.fd = -1;
+            }
+            finish_job(job);
+            job.fd = -2;
+            continue;
+        }
+
+        struct io_uring_sqe* sqe = sqe_get(r, sqtail);
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = job.fd;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = (i << 2) | OP_CLOSE;
+
+        sqe = sqe_get(r, sqtail);
+        sqe->opcode = IORING_OP_RENAMEAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uint64_t)job.tmp.c_str();
+        sqe->len = AT_FDCWD;
+        sqe->addr2 = (uint64_t)job.fname.c_str();
+        sqe->user_data = (i << 2) | OP_RENAME;
+        n += 2;
+    }
+    submit(n, jobs);
+
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        Job& job = jobs[i];
+        if (job.fd == -2) continue;
+        if (job.closed < 0) {
+            job.err = failure(job, "write", -job.closed);
+            unlink(job.tmp.c_str());
+        } else if (job.renamed < 0 && rename(job.tmp.c_str(), job.fname.c_str()) != 0) {
+            /* Renaming isn't supported by older kernels, so it was retried normally */
+            job.err = failure(job, "rename", errno);
+            unlink(job.tmp.c_str());
+        }
+        job.fd = -1;
+    }
+}
+
+}
@@ -7,43 +7,107 @@
 
 #include <doq.hh>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 namespace doq {
 
 
+/* Link button next to headings and definitions (which is repeated many times), and a shorter equivalent
+ *   used when minifying
+ */
+static const char linkbutton[] = "' class='link-div'><svg viewBox='0 0 16 16' aria-hidden='true'><use xlink:href='#svg-link'></use></svg></a>";
+static const char linkbutton_min[] = "' class='link-div'><svg viewBox='0 0 16 16' aria-hidden='true'><use href='#svg-link'/></svg></a>";
+
+/* Returns the replacement text for a character that must be escaped in HTML, or NULL if the character is safe */
+static const char* esc_get(char c) {
+    switch (c) {
+    case '<': return "&lt;";
+    case '>': return "&gt;";
+    case '&': return "&amp;";
+    case '"': return "&quot;";
+    case '\'': return "&#39;";
+    default: return NULL;
+    }
+}
+
+/* Returns the index of the first character in 's' that needs work (an escape, or a newline if 'nl'), or 'n'
+ *   if there are none
+ *
+ * On x86_64, this checks 16 bytes at a time with SSE2, and only falls back to a byte loop for the tail
+ */
+static size_t esc_scan(const char* s, size_t n, bool nl) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i v_lt = _mm_set1_epi8('<'), v_gt = _mm_set1_epi8('>'), v_amp = _mm_set1_epi8('&');
+    const __m128i v_dq = _mm_set1_epi8('"'), v_sq = _mm_set1_epi8('\'');
+    const __m128i v_nl = _mm_set1_epi8(nl ? '\n' : '<');
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i m = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, v_lt), _mm_cmpeq_epi8(v, v_gt)),
+            _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, v_amp), _mm_cmpeq_epi8(v, v_dq)),
+                _mm_or_si128(_mm_cmpeq_epi8(v, v_sq), _mm_cmpeq_epi8(v, v_nl))
+            )
+        );
+        int mask = _mm_movemask_epi8(m);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; i < n; ++i) {
+        char c = s[i];
+        if (esc_get(c) || (nl && c == '\n')) {
+            return i;
+        }
+    }
+    return n;
+}
+
 void HTMLOutput::dump_esc(const string& x) {
     bool para = doparastk.back();
-    for (size_t i = 0; i < x.size(); ++i) {
-        char c = x[i];
-        if (c == '\n' && para) {
+    const char* s = x.data();
+    size_t n = x.size();
+
+    if (dosearch && curdoc >= 0) {
+        search.add(curdoc, s, n);
+    }
+
+    size_t i = 0;
+    while (i < n) {
+        if (para && s[i] == '\n') {
             if (inpara) {
                 dump("</p>\n");
                 inpara = false;
             }
-            
-            i++;
+
             /* Skip newlines */
-            while (i < x.size() && x[i] == '\n') {
+            while (i < n && s[i] == '\n') {
                 i++;
             }
             needspara = true;
+            continue;
+        }
 
-        } else {
-            if (para && needspara) {
-                dump("<p>");
-                needspara = false;
-                inpara = true;
-            }
+        if (para && needspara) {
+            dump("<p>");
+            needspara = false;
+            inpara = true;
+        }
 
-            if (c == '<') {
-                dump("&lt;");
-            } else if (c == '>') {
-                dump("&gt;");
-            } else {
-                dump(c);
-            }
+        /* Copy the clean span in bulk, then handle the character that stopped it */
+        size_t j = i + esc_scan(s + i, n - i, para);
+        fp.write(s + i, j - i);
+        i = j;
+        if (i < n && s[i] != '\n') {
+            dump(esc_get(s[i]));
+            i++;
         }
     }
-    if (x.size() == 0) {
+    if (n == 0) {
         if (para && needspara) {
             dump("<p>");
             needspara = false;
@@ -52,19 +116,81 @@ void HTMLOutput::dump_esc(const string& x) {
     }
 }
 
-string HTMLOutput::plain(const string& x) {
-    string r = "";
-    for (size_t i = 0; i < x.size(); ++i) {
-        char c = x[i];
-        if (c == '<' || c == '>' || c == '?' || c == '!' || c == '(' || c == ':' || c == ';' || c == '[' || c == ']') {
-            return r;
-        } else if (c == ' ' || c == '\t') {
-            r += "_";
+void htmlesc(string& res, const char* s, size_t n) {
+    size_t i = 0;
+    while (i < n) {
+        size_t j = i + esc_scan(s + i, n - i, false);
+        res.append(s + i, j - i);
+        i = j;
+        if (i < n) {
+            res += esc_get(s[i]);
+            i++;
+        }
+    }
+}
+
+const string& HTMLOutput::highlighted(Item* item) {
+    string code;
+    for (size_t i = 0; i < item->sub.size(); ++i) {
+        item->sub[i]->flatten(code);
+    }
+
+    /* Identical code blocks are only highlighted once */
+    pair<unordered_map<string, string>::iterator, bool> it = hlcache.insert(make_pair(item->sval + '\n' + code, string()));
+    if (it.second) {
+        highlight(it.first->second, get_grammar(item->sval), code);
+    }
+    return it.first->second;
+}
+
+const string& HTMLOutput::mathml(Item* item) {
+    bool block = item->kind == Item::Kind::MATHBLOCK;
+    string tex = item->sval;
+    for (size_t i = 0; i < item->sub.size(); ++i) {
+        item->sub[i]->flatten(tex);
+    }
+
+    /* Identical formulas are only converted once (an empty result means the conversion failed) */
+    pair<unordered_map<string, string>::iterator, bool> it = mathcache.insert(make_pair((block ? "B" : "I") + tex, string()));
+    if (it.second && !tex2mathml(it.first->second, tex, block)) {
+        mathfailed = true;
+    }
+    return it.first->second;
+}
+
+bool HTMLOutput::needmathjax() {
+    /* Convert every formula in the project, and check if any failed (without recursion) */
+    vector<Item*> stk;
+    for (size_t i = 0; i < proj->nav.size(); ++i) {
+        stk.push_back(proj->nav[i].node->val);
+    }
+    bool res = false;
+    while (stk.size() > 0) {
+        Item* it = stk.back();
+        stk.pop_back();
+        if (it->kind == Item::Kind::MATH || it->kind == Item::Kind::MATHBLOCK) {
+            if (mathml(it).size() == 0) {
+                res = true;
+            }
         } else {
-            r += c;
+            stk.insert(stk.end(), it->sub.begin(), it->sub.end());
         }
     }
-    return r;
+    return res;
+}
+
+void HTMLOutput::dump_mathjax() {
+    dumpl("<!-- MathJax -->");
+    dumpl("    <script>");
+    dumpl("    MathJax = {");
+    dumpl("        tex: {");
+    dumpl("            inlineMath: [['$', '$']]");
+    dumpl("        }");
+    dumpl("    };");
+    dumpl("    </script>");
+    dumpl("    <script src='//polyfill.io/v3/polyfill.min.js?features=es6'></script>");
+    dumpl("    <script id='MathJax-script' async src='//cdn.jsdelivr.net/npm/mathjax@3/es5/tex-mml-chtml.js'></script>");
+    dumpl("");
 }
 
 void HTMLOutput::dump_item(Item* item) {
@@ -113,8 +239,17 @@ void HTMLOutput::dump_item(Item* item) {
         dump("</u>");
         break;
     case Item::Kind::REF:
-        dump("<a href='#");
-        dump(plain(item->sval));
+        if (item->ext >= 0) {
+            /* Defined in another project */
+            dump("<a href='");
+            dump(proj->externs[item->ext]);
+        } else if (item->target >= 0) {
+            dump("<a href='#");
+            dump(proj->anchors[item->target].id);
+        } else {
+            dump("<a href='#");
+            dump(item->id());
+        }
         dump("'>");
         for (size_t i = 0; i < item->sub.size(); ++i) {
             dump_item(item->sub[i]);
@@ -132,14 +267,49 @@ void HTMLOutput::dump_item(Item* item) {
         dump("</a>");
         break;
 
+    case Item::Kind::IMAGE: {
+        const ImageCache::Image& img = proj->image(item->sval);
+        images[img.name] = &img;
+
+        /* Start a paragraph, if needed */
+        dump_esc("");
+        dump("<img src='");
+        dump(img.name);
+        dump("' alt='");
+        string alt;
+        for (size_t i = 0; i < item->sub.size(); ++i) {
+            item->sub[i]->flatten(alt);
+        }
+        doparastk.push_back(false);
+        dump_esc(alt);
+        doparastk.pop_back();
+        dump("'");
+        /* The size is known before the image loads, so the page doesn't shift around */
+        if (img.width >= 0) {
+            dump(" width='");
+            dump(img.width);
+            dump("' height='");
+            dump(img.height);
+            dump("'");
+        }
+        dump(" loading='lazy' decoding='async'>");
+        break;
+    }
+
     case Item::Kind::CODE:
         doparastk.push_back(false);
 
         dump("<pre class='language-");
         dump_esc(item->sval);
-        dump("'><code>");
-        for (size_t i = 0; i < item->sub.size(); ++i) {
-            dump_item(item->sub[i]);
+        if (get_grammar(item->sval)) {
+            /* Highlight at build time */
+            dump("'><code class='hljs'>");
+            dump(highlighted(item));
+        } else {
+            dump("'><code>");
+            for (size_t i = 0; i < item->sub.size(); ++i) {
+                dump_item(item->sub[i]);
+            }
         }
         dump("</code></pre>");
         doparastk.pop_back();
@@ -147,23 +317,33 @@ void HTMLOutput::dump_item(Item* item) {
 
     case Item::Kind::MATH:
         doparastk.push_back(false);
-        dump("$");
-        dump_esc(item->sval);
-        for (size_t i = 0; i < item->sub.size(); ++i) {
-            dump_item(item->sub[i]);
+        if (mathml(item).size() > 0) {
+            dump(mathml(item));
+        } else {
+            /* Pass along the TeX, for MathJax */
+            dump("$");
+            dump_esc(item->sval);
+            for (size_t i = 0; i < item->sub.size(); ++i) {
+                dump_item(item->sub[i]);
+            }
+            dump("$");
         }
-        dump("$");
         doparastk.pop_back();
         break;
 
     case Item::Kind::MATHBLOCK:
         doparastk.push_back(false);
-        dump("$$");
-        dump_esc(item->sval);
-        for (size_t i = 0; i < item->sub.size(); ++i) {
-            dump_item(item->sub[i]);
+        if (mathml(item).size() > 0) {
+            dump(mathml(item));
+        } else {
+            /* Pass along the TeX, for MathJax */
+            dump("$$");
+            dump_esc(item->sval);
+            for (size_t i = 0; i < item->sub.size(); ++i) {
+                dump_item(item->sub[i]);
+            }
+            dump("$$");
         }
-        dump("$$");
         doparastk.pop_back();
         break;
 
@@ -186,13 +366,18 @@ void HTMLOutput::dump_item(Item* item) {
         doparastk.pop_back();
         break;
 
-    case Item::Kind::DICT:
+    case Item::Kind::DICT: {
+        /* Anchor of the current entry, and the document being indexed outside of the dictionary */
+        int entry = -1, lastdoc = curdoc;
+
         dump("<dl>");
         for (size_t i = 0; i < item->sub.size(); ++i) {
             if (i % 2 == 0) {
+                entry = entryanchor(item->sub[i]);
+                if (entry >= 0) curdoc = entry;
                 doparastk.push_back(false);
 
-                string id = plain(item->sub[i]->flatten());
+                const string& id = item->sub[i]->id();
                 if (id.size() > 0) {
                     /* ID-label */
                     dump("<dt id='");
@@ -206,7 +391,7 @@ void HTMLOutput::dump_item(Item* item) {
 
                 dump("<a href='#");
                 dump(id);
-                dump("' class='link-div'><svg viewBox='0 0 16 16' aria-hidden='true'><use xlink:href='#svg-link'></use></svg></a>");
+                dump(minify ? linkbutton_min : linkbutton);
 
                 dump("</dt>");
                 doparastk.pop_back();
@@ -214,11 +399,17 @@ void HTMLOutput::dump_item(Item* item) {
             } else {
                 dump("<dd>");
                 dump_item(item->sub[i]);
+                if (backlinks && entry >= 0) {
+                    dump_backlinks(entry);
+                }
                 dump("</dd>");
+                curdoc = lastdoc;
             }
         }
         dump("</dl>");
+        curdoc = lastdoc;
         break;
+    }
 
     default:
         /* Default is to join everything together */
@@ -230,29 +421,70 @@ void HTMLOutput::dump_item(Item* item) {
     }
 }
 
+int HTMLOutput::entryanchor(Item* key) {
+    unordered_map<string, int>::iterator f = proj->anchormap.find(key->id());
+    if (f != proj->anchormap.end() && proj->anchors[f->second].navi == curnavi && proj->anchors[f->second].ci >= 0) {
+        return f->second;
+    }
+    return -1;
+}
+
+void HTMLOutput::dump_backlinks(int anchor) {
+    int st = proj->backoff[anchor], en = proj->backoff[anchor + 1];
+    if (st >= en) return;
+
+    /* Don't index the names of other anchors */
+    int lastdoc = curdoc;
+    curdoc = -1;
+
+    doparastk.push_back(false);
+    dump("<div class='backlinks'>Referenced by: ");
+    for (int i = st; i < en; ++i) {
+        int src = proj->backsrc[i];
+        if (i > st) dump(", ");
+        dump("<a href='#");
+        dump(proj->anchors[src].id);
+        dump("'>");
+        dump_esc(proj->anchorname(src));
+        dump("</a>");
+    }
+    dump("</div>");
+    doparastk.pop_back();
+    curdoc = lastdoc;
+}
+
 void HTMLOutput::dump_node(Node* node) {
-    vector<int> idxs = node->get_posi();
+    int lastnavi = curnavi, lastdoc = curdoc;
+    curnavi = node->navi;
     doparastk.push_back(true);
 
+    /* Anchor of this node (if it wasn't also defined elsewhere), which is the document for its content */
+    const string& id = node->id;
+    int self = -1;
+    unordered_map<string, int>::iterator f = proj->anchormap.find(id);
+    if (id.size() > 0 && f != proj->anchormap.end() && proj->anchors[f->second].navi == node->navi) {
+        self = f->second;
+    }
+    curdoc = self;
+    if (dosearch && self >= 0) {
+        search.add(self, node->name.data(), node->name.size());
+    }
+
     /* Output header */
-    string id = plain(node->name);
     if (id.size() > 0) {
         dump("<h");
-        dump(idxs.size());
+        dump(node->depth);
         dump(" id='");
         dump(id);
         dump("'>");
     } else {
         dump("<h");
-        dump(idxs.size());
+        dump(node->depth);
         dump(">");
     }
 
     /* Output a section ID */
-    for (size_t i = 1; i < idxs.size(); ++i) {
-        dump(idxs[i] + 1);
-        dump(".");
-    }
+    dump(node->secnum);
 
     /* And the name */
     dump(" ");
@@ -262,155 +494,296 @@ void HTMLOutput::dump_node(Node* node) {
 
     dump("<a href='#");
     dump(id);
-    dump("' class='link-div'><svg viewBox='0 0 16 16' aria-hidden='true'><use xlink:href='#svg-link'></use></svg></a>");
+    dump(minify ? linkbutton_min : linkbutton);
 
     /* Close tag */
     dump("</h");
-    dump(idxs.size());
+    dump(node->depth);
     dump(">");
     dump("\n");
 
 
     /* Dump table of contents */
     if (id.size() > 0) {
-        /* If we are top level, do a full TOC */
-        bool recurse = idxs.size() == 1;
-        Item* toc = node->toc(recurse);
-        dump_item(toc);
-        delete toc;
+        dump(toc(node->navi));
     }
 
 
     /* Dump the content of this node */
     dump_item(node->val);
 
+    if (backlinks && self >= 0) {
+        dump_backlinks(self);
+    }
+
     /* Also output the children nodes */
     for (size_t i = 0; i < node->sub.size(); ++i) {
         dump_node(node->sub[i]);
     }
 
     doparastk.pop_back();
+    curnavi = lastnavi;
+    curdoc = lastdoc;
 
 }
 
-void HTMLOutput::sidebar(Node* node) {
-    dump("<li>");
+void HTMLOutput::render_toc(string& res, int navi, bool recurse) {
+    const NavEntry& e = proj->nav[navi];
+    res += "<ul>";
+    for (size_t i = 0; i < e.sub.size(); ++i) {
+        const NavEntry& c = proj->nav[e.sub[i]];
+        res += "<li><a href='#";
+        res += c.id;
+        res += "'>";
+        htmlesc(res, c.name.data(), c.name.size());
+        res += "</a>";
+        if (c.desc.size() > 0) {
+            res += ": ";
+            htmlesc(res, c.desc.data(), c.desc.size());
+        }
+        if (recurse) {
+            render_toc(res, e.sub[i], recurse);
+        }
+        res += "</li>";
+    }
 
-    dump("<a href='#");
-    dump(plain(node->name));
-    dump("'>");
+    for (size_t i = 0; i < e.contains.size() && !recurse; ++i) {
+        if (e.contains[i].size() > 0) {
+            res += "<li><a href='#";
+            res += e.containsid[i];
+            res += "'><span class='monoi'>";
+            res += e.contains[i];
+            res += "</span></a></li>";
+        }
+    }
+    res += "</ul>";
+}
 
-    dump(node->name);
-    dump("</a>");
-    
-    dump("<ul>");
-    for (size_t i = 0; i < node->sub.size(); ++i) {
-        sidebar(node->sub[i]);
+const string& HTMLOutput::toc(int navi) {
+    if (tocs.size() != proj->nav.size()) {
+        tocs.resize(proj->nav.size());
+    }
+    string& res = tocs[navi];
+    if (res.size() == 0) {
+        /* If we are top level, do a full TOC */
+        render_toc(res, navi, proj->nav[navi].depth == 1);
     }
-    dump("</ul>");
-    dump("</li>");
+    return res;
+}
 
+const string& HTMLOutput::sidebar() {
+    if (side.size() == 0) {
+        /* Entries are in pre-order, as parallel arrays of names, IDs, and parent indices (the root is left out) */
+        size_t n = proj->nav.size();
+        side += "doq_nav_load([";
+        for (size_t i = 1; i < n; ++i) {
+            if (i > 1) side += ',';
+            jsonstr(side, proj->nav[i].name);
+        }
+        side += "],\n[";
+        for (size_t i = 1; i < n; ++i) {
+            if (i > 1) side += ',';
+            jsonstr(side, proj->nav[i].id);
+        }
+        side += "],\n[";
+        for (size_t i = 1; i < n; ++i) {
+            if (i > 1) side += ',';
+            side += to_string(proj->nav[i].par - 1);
+        }
+        side += "]);\n";
+    }
+    return side;
 }
 
 void HTMLOutput::init() {
-    // Make output directory
+    // Make output directory, and find what the last build wrote there
     mkdir(dest.c_str(), 0777);
+    manifest = new Manifest(dest);
+    files = new FileQueue();
+    fp.manifest = manifest;
+    fp.files = files;
+    fp.spool = proj->streaming;
+    search.manifest = manifest;
+    search.files = files;
+    search.compress = compress;
+
+    // Copy assets (under names with a hash of their contents), and compress them while the page renders
+    const char* names[] = { "doq.css", "hljs-ks.js", "doq.js" };
+    for (size_t i = 0; i < sizeof(names) / sizeof(*names); ++i) {
+        string src = assetpath + "/" + names[i];
+        string data = readall(src);
+        string name = hashname(names[i], data);
+        string fname = dest + "/" + name;
+        assets[names[i]] = name;
+        if (manifest->changed(fname, hash64(data.data(), data.size()))) {
+            copyfile(fname, src);
+        }
 
-    // Copy existing assets
-    copyfile(dest + "/doq.css", assetpath + "/doq.css");
-    copyfile(dest + "/hljs-ks.js", assetpath + "/hljs-ks.js");
-    copyfile(dest + "/doq.js", assetpath + "/doq.js");
+        for (int k = Compressor::GZIP; k <= Compressor::BROTLI; k <<= 1) {
+            if ((compress & k) && access((fname + Compressor::ext((Compressor::Kind)k)).c_str(), F_OK) != 0) {
+                /* Since the name depends on the contents, an existing sidecar is already up to date */
+                Compressor* c = new Compressor(fname, (Compressor::Kind)k);
+                sidecars.push_back(c);
+                c->feed(data.data(), data.size());
+            }
+        }
+    }
+
+    // Read the page template, and find what fills in each of its slots
+    page = Template(tmplpath.size() > 0 ? tmplpath : assetpath + "/page.html");
+    for (size_t i = 0; i < page.slots.size(); ++i) {
+        fills.push_back(filler(page.slots[i]));
+    }
 
     // Open the main file
-    fp.open(dest + "/index.html", ios::out);
+    fp.open(dest + "/index.html");
+    if (minify) {
+        fp.minify();
+    }
+    fp.compress(compress);
 
     doparastk.push_back(false);
 
 
 }
 
-void HTMLOutput::exec() {
-
-    /* HTML text */
-    dumpl("<!DOCTYPE html>");
-    dumpl("<html lang='en'>");
-    dumpl("<head>");
-    dumpl("    <meta charset='utf-8'>");
-    dumpl("    <meta http-equiv='X-UA-Compatible' content='IE=edge'>");
-    dumpl("    <meta name='viewport' content='width=device-width,initial-scale=1.0'>");
-    dump("    <title>");
-    dump_esc(proj->get("project")->flatten());
-    dumpl("</title>");
-    dumpl("");
-    dumpl("<!-- MathJax -->");
-    dumpl("    <script>");
-    dumpl("    MathJax = {");
-    dumpl("        tex: {");
-    dumpl("            inlineMath: [['$', '$']]");
-    dumpl("        }");
-    dumpl("    };");
-    dumpl("    </script>");
-    dumpl("    <script src='//polyfill.io/v3/polyfill.min.js?features=es6'></script>");
-    dumpl("    <script id='MathJax-script' async src='//cdn.jsdelivr.net/npm/mathjax@3/es5/tex-mml-chtml.js'></script>");
-    dumpl("");
-    dumpl("<!-- highlight.js -->");
-    dumpl("    <script src='//cdnjs.cloudflare.com/ajax/libs/highlight.js/10.4.0/highlight.min.js'></script>");
-    dumpl("    <script>hljs.initHighlightingOnLoad();</script>");
-    dumpl("");
-    dumpl("<!-- doq specific assets -->");
-    dumpl("    <link rel='stylesheet' href='doq.css'>");
-    dumpl("    <script src='./doq.js'></script>");
-    dumpl("    <script src='./hljs-ks.js'></script>");
-    dumpl("");
+/* Whether highlight.js is needed, for languages that can't be highlighted at build time */
+static bool needhljs(Project* proj) {
+    for (map<string, int>::iterator it = proj->langs.begin(); it != proj->langs.end(); ++it) {
+        if (it->first != "text" && !get_grammar(it->first)) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    dumpl("</head>");
-    dumpl("<body>");
-    dumpl("");
-    dumpl("<!-- SVG -->");
-    dumpl("<svg xmlns='http://www.w3.org/2000/svg' style='display: none;'>");
-    dumpl("    <!-- Link SVG -->");
-    dumpl("    <symbol id='svg-link' viewBox='0 0 24 24'>");
-    dumpl("    <title>Link</title>");
-    dumpl("    <svg xmlns='http://www.w3.org/2000/svg' width='24' height='24' viewBox='0 0 24 24' fill='none' stroke='currentColor' stroke-width='2' stroke-linecap='round' stroke-linejoin='round' class='feather feather-link'>");
-    dumpl("        <path d='M10 13a5 5 0 0 0 7.54.54l3-3a5 5 0 0 0-7.07-7.07l-1.72 1.71'></path>");
-    dumpl("        <path d='M14 11a5 5 0 0 0-7.54-.54l-3 3a5 5 0 0 0 7.07 7.07l1.71-1.71'></path>");
-    dumpl("    </svg>");
-    dumpl("    </symbol>");
-    dumpl("</svg>");
-    dumpl("");
+function<void()> HTMLOutput::filler(const string& name) {
+    if (name == "title") {
+        return [this]() {
+            dump_esc(proj->get("project")->flatten());
+        };
+    } else if (name == "mathjax") {
+        /* Only load MathJax if some formulas couldn't be converted to MathML (when streaming, that isn't
+         *   known until the end, so it goes in 'mathjax-end' instead)
+         */
+        return [this]() {
+            if (!proj->streaming && needmathjax()) {
+                dump_mathjax();
+            }
+        };
+    } else if (name == "mathjax-end") {
+        return [this]() {
+            if (proj->streaming && mathfailed) {
+                dump_mathjax();
+            }
+        };
+    } else if (name == "hljs") {
+        return [this]() {
+            if (needhljs(proj)) {
+                dumpl("<!-- highlight.js -->");
+                dumpl("    <script src='//cdnjs.cloudflare.com/ajax/libs/highlight.js/10.4.0/highlight.min.js'></script>");
+                dumpl("");
+            }
+        };
+    } else if (name == "hljs-ks") {
+        return [this]() {
+            if (needhljs(proj)) {
+                dump("    <script src='./");
+                dump(assets["hljs-ks.js"]);
+                dumpl("'></script>");
+                dumpl("    <script>doq_highlight();</script>");
+            }
+        };
+    } else if (name == "search") {
+        return [this]() {
+            if (dosearch) {
+                dumpl("<input id='doq-search' type='search' placeholder='Search' autocomplete='off' oninput='doq_search(this.value)'>");
+                dumpl("<ul id='doq-search-results'></ul>");
+            }
+        };
+    } else if (name == "content") {
+        return [this]() {
+            dump_content();
+        };
+    } else if (name.substr(0, 6) == "asset:" && assets.find(name.substr(6)) != assets.end()) {
+        string fname = assets[name.substr(6)];
+        return [this, fname]() {
+            dump(fname);
+        };
+    } else if (name.substr(0, 4) == "var:") {
+        /* Project variables, like '{{var:copyright}}' */
+        string var = name.substr(4);
+        return [this, var]() {
+            dump_esc(proj->get(var)->flatten());
+        };
+    }
+    throw runtime_error(page.fname + ": unknown slot '{{" + name + "}}' in template");
+}
 
-    /* Generate sidebar */
-    dumpl("<div id='sidenav' class='sidenav'><div>");
-    dump("<ul>");
-    for (size_t i = 0; i < proj->root->sub.size(); ++i) {
-        sidebar(proj->root->sub[i]);
+void HTMLOutput::dump_content() {
+    dump_node(proj->root);
+    if (proj->streaming) {
+        /* The top-level nodes weren't kept, so output each one as it is parsed again */
+        proj->stream([this](Node* node) {
+            dump_node(node);
+
+            /* Drop what was cached for it, so memory doesn't grow with the document */
+            hlcache.clear();
+            mathcache.clear();
+            for (size_t i = node->navi; i < tocs.size() && (i == (size_t)node->navi || proj->nav[i].depth > 1); ++i) {
+                string().swap(tocs[i]);
+            }
+        });
     }
-    dump("</ul>");
+}
 
+void HTMLOutput::exec() {
+    /* The layout of the page is in the template, which calls back for the parts that are generated */
+    page.render(fp, fills);
+}
 
-    /*
-    dumpl("<div class='sidenav-bottom'>");
-    dump_item(proj->get("copyright"));
-    dumpl("</div>");
-    */
+void HTMLOutput::fini() {
+    fp.close();
 
-    dumpl("</div></div>");
+    const string& nav = sidebar();
+    fp.open(dest + "/nav.js");
+    fp.compress(compress);
+    fp.write(nav.data(), nav.size());
+    fp.close();
 
-    /* Main content */
-    dumpl("<div class='main'><div>");
-    dump_node(proj->root);
-    dumpl("</div></div>");
+    /* Images (which, since their names depend on the contents, are only copied if they weren't already) */
+    for (map<string, const ImageCache::Image*>::iterator it = images.begin(); it != images.end(); ++it) {
+        string fname = dest + "/" + it->first;
+        if (manifest->changed(fname, it->second->hash)) {
+            copyfile(fname, it->second->src);
+        }
+    }
 
-    dumpl("<svg class='sidenav-button' onclick='doq_togglesidenav()' viewBox='0 0 100 80' width='40' height='40'><rect width='100' height='20'></rect><rect y='30' width='100' height='20'></rect><rect y='60' width='100' height='20'></rect></svg>");
+    /* Inventory of anchors, so other projects can refer to them */
+    vector<pair<string, string>> ents;
+    for (size_t i = 0; i < proj->anchors.size(); ++i) {
+        ents.push_back(make_pair(proj->anchors[i].id, "index.html#" + proj->anchors[i].id));
+    }
+    fp.open(dest + "/doq.inv");
+    Inventory::write(fp, ents);
+    fp.close();
 
-    /* HTML end */
-    dumpl("</body>");
-    dumpl("</html>");
+    if (dosearch) {
+        vector<pair<string, string>> docs;
+        for (size_t i = 0; i < proj->anchors.size(); ++i) {
+            docs.push_back(make_pair(proj->anchors[i].id, proj->anchorname(i)));
+        }
+        search.write(dest + "/search", docs);
+    }
 
-}
+    for (size_t i = 0; i < sidecars.size(); ++i) {
+        sidecars[i]->finish();
+        delete sidecars[i];
+    }
+    sidecars.clear();
 
-void HTMLOutput::fini() {
-    fp.close();
+    files->wait();
+    manifest->finish();
 }
 
 }
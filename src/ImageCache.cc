@@ -0,0 +1,142 @@
+/* ImageCache.cc - implementation of the 'doq::ImageCache' type
+ *
+ * Sizes are read straight from the headers of the formats that are common on the web, so no image library
+ *   is needed. Only as much of the file as the header takes is looked at (but the whole file is hashed)
+ *
+ * @author: Cade Brown <cade@kscript.org>
+ */
+
+#include <doq.hh>
+
+namespace doq {
+
+/* Read big-endian and little-endian integers */
+static uint32_t be16(const unsigned char* p) {
+    return (p[0] << 8) | p[1];
+}
+static uint32_t be32(const unsigned char* p) {
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+static uint32_t le16(const unsigned char* p) {
+    return p[0] | (p[1] << 8);
+}
+
+/* Sets 'val' to the value of the attribute 'name' in the tag 'tag', and returns whether it was found */
+static bool svgattr(const string& tag, const string& name, string& val) {
+    size_t i = 0;
+    while ((i = tag.find(name, i)) != string::npos) {
+        size_t j = i + name.size();
+        /* Has to be a whole name (so 'width' doesn't match 'stroke-width') */
+        if (i > 0 && isspace((unsigned char)tag[i - 1])) {
+            while (j < tag.size() && isspace((unsigned char)tag[j])) j++;
+            if (j < tag.size() && tag[j] == '=') {
+                j++;
+                while (j < tag.size() && isspace((unsigned char)tag[j])) j++;
+                if (j < tag.size() && (tag[j] == '"' || tag[j] == '\'')) {
+                    size_t e = tag.find(tag[j], j + 1);
+                    if (e == string::npos) return false;
+                    val = tag.substr(j + 1, e - j - 1);
+                    return true;
+                }
+            }
+        }
+        i = j;
+    }
+    return false;
+}
+
+/* Parses a length in pixels (with no unit, or 'px'), and returns whether it was one */
+static bool svglen(const string& val, int& res) {
+    const char* s = val.c_str();
+    char* e;
+    double x = strtod(s, &e);
+    while (isspace((unsigned char)*e)) e++;
+    if (e == s || x <= 0 || (*e != '\0' && strcmp(e, "px") != 0)) {
+        return false;
+    }
+    res = (int)(x + 0.5);
+    return true;
+}
+
+bool ImageCache::dimensions(const string& data, int& width, int& height) {
+    const unsigned char* p = (const unsigned char*)data.data();
+    size_t n = data.size();
+
+    if (n >= 24 && memcmp(p, "\x89PNG\r\n\x1a\n", 8) == 0 && memcmp(p + 12, "IHDR", 4) == 0) {
+        width = be32(p + 16);
+        height = be32(p + 20);
+        return true;
+    }
+    if (n >= 10 && (memcmp(p, "GIF87a", 6) == 0 || memcmp(p, "GIF89a", 6) == 0)) {
+        width = le16(p + 6);
+        height = le16(p + 8);
+        return true;
+    }
+    if (n >= 4 && p[0] == 0xFF && p[1] == 0xD8) {
+        /* JPEG, which is a list of segments, where the size is in the start of frame ('SOFn') */
+        size_t i = 2;
+        while (i + 9 < n) {
+            if (p[i] != 0xFF) return false;
+            int m = p[i + 1];
+            if (m == 0xFF) {
+                /* Padding */
+                i++;
+            } else if (m == 0x01 || (0xD0 <= m && m <= 0xD9)) {
+                /* Markers without a length */
+                i += 2;
+            } else if (0xC0 <= m && m <= 0xCF && m != 0xC4 && m != 0xC8 && m != 0xCC) {
+                height = be16(p + i + 5);
+                width = be16(p + i + 7);
+                return true;
+            } else {
+                i += 2 + be16(p + i + 2);
+            }
+        }
+        return false;
+    }
+
+    /* SVG, which has the size in the attributes of the '<svg>' tag (or else its 'viewBox') */
+    size_t st = data.find("<svg");
+    if (st != string::npos && st < 4096) {
+        size_t en = data.find('>', st);
+        if (en == string::npos) return false;
+        string tag = data.substr(st, en - st);
+
+        string w, h, vb;
+        if (svgattr(tag, "width", w) && svgattr(tag, "height", h)) {
+            return svglen(w, width) && svglen(h, height);
+        } else if (svgattr(tag, "viewBox", vb)) {
+            double x, y, vw, vh;
+            if (sscanf(vb.c_str(), "%lf%*[ ,]%lf%*[ ,]%lf%*[ ,]%lf", &x, &y, &vw, &vh) == 4 && vw > 0 && vh > 0) {
+                width = (int)(vw + 0.5);
+                height = (int)(vh + 0.5);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+const ImageCache::Image& ImageCache::get(const string& fname) {
+    Image* img;
+    {
+        lock_guard<mutex> lock(mu);
+        Image*& it = images[fname];
+        if (!it) it = new Image();
+        img = it;
+    }
+
+    /* Other threads that want the same image wait here until it has been read */
+    call_once(img->once, [&]() {
+        string data = readall(fname);
+        img->src = fname;
+        img->name = hashname(fname.substr(fname.rfind('/') + 1), data);
+        img->hash = hash64(data.data(), data.size());
+        if (!dimensions(data, img->width, img->height)) {
+            img->width = img->height = -1;
+        }
+    });
+    return *img;
+}
+
+}
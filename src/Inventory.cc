@@ -0,0 +1,82 @@
+/* Inventory.cc - implementation of the 'doq::Inventory' type
+ *
+ * @author: Cade Brown <cade@kscript.org>
+ */
+
+#include <doq.hh>
+
+namespace doq {
+
+/* Magic bytes and version, at the start of the file */
+static const char MAGIC[4] = { 'D', 'O', 'Q', 'I' };
+static const uint32_t VERSION = 1;
+
+/* Size of the header (magic, version, number of entries, and size of the string table) */
+static const size_t HEADSIZE = 16;
+
+Inventory::Inventory(const string& fname_, const string& base_) : fname(fname_), base(base_) {
+    data = mapall(fname, size);
+
+    const uint32_t* head = (const uint32_t*)data;
+    if (size < HEADSIZE || memcmp(data, MAGIC, sizeof(MAGIC)) != 0 || head[1] != VERSION
+        || HEADSIZE + (uint64_t)head[2] * 16 + head[3] != size) {
+        unmapall(data, size);
+        throw runtime_error("Not a doq inventory (or a different version): '" + fname + "'");
+    }
+    n = head[2];
+    ents = head + 4;
+    strs = data + HEADSIZE + (size_t)n * 16;
+
+    /* Only the entries that are looked up are read */
+    madvise(data, size, MADV_RANDOM);
+}
+
+Inventory::~Inventory() {
+    unmapall(data, size);
+}
+
+bool Inventory::find(const string& id, string& url) const {
+    uint32_t lo = 0, hi = n;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const uint32_t* e = ents + 4 * mid;
+        int c = memcmp(strs + e[0], id.data(), min((size_t)e[1], id.size()));
+        if (c == 0) {
+            c = e[1] < id.size() ? -1 : (e[1] > id.size() ? 1 : 0);
+        }
+        if (c == 0) {
+            url = base;
+            url.append(strs + e[2], e[3]);
+            return true;
+        } else if (c < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return false;
+}
+
+void Inventory::write(Writer& fp, vector<pair<string, string>>& ents) {
+    sort(ents.begin(), ents.end());
+
+    vector<uint32_t> head = { 0, VERSION, (uint32_t)ents.size(), 0 };
+    memcpy(&head[0], MAGIC, sizeof(MAGIC));
+    vector<uint32_t> offs;
+    string strs;
+    for (size_t i = 0; i < ents.size(); ++i) {
+        offs.push_back(strs.size());
+        offs.push_back(ents[i].first.size());
+        strs += ents[i].first;
+        offs.push_back(strs.size());
+        offs.push_back(ents[i].second.size());
+        strs += ents[i].second;
+    }
+    head[3] = strs.size();
+
+    fp.write((const char*)head.data(), head.size() * sizeof(uint32_t));
+    fp.write((const char*)offs.data(), offs.size() * sizeof(uint32_t));
+    fp.write(strs.data(), strs.size());
+}
+
+}
@@ -1,4 +1,4 @@
-/* Node.cc - implementation of the 'doq::Node' type
+/* Item.cc - implementation of the 'doq::Item' type
  *
  * @author: Cade Brown <cade@kscript.org>
  */
@@ -15,16 +15,47 @@ Item* Item::copy() {
         res->sub.push_back(sub[i]->copy());
     }
 
+    res->line = line;
+    res->col = col;
+    res->target = target;
+    res->ext = ext;
+
+    /* Keep cached values, so they aren't recomputed for the copy */
+    res->flat = flat;
+    res->hasflat = hasflat;
+    res->aid = aid;
+    res->hasid = hasid;
+
     return res;
 }
 
 
-string Item::flatten() {
-    string res = sval;
-    for (size_t i = 0; i < sub.size(); ++i) {
-        res += sub[i]->flatten();
+const string& Item::flatten() {
+    if (!hasflat) {
+        flat.clear();
+        flatten(flat);
+        hasflat = true;
     }
-    return res;
+    return flat;
+}
+
+void Item::flatten(string& res) {
+    if (hasflat) {
+        res += flat;
+    } else {
+        res += sval;
+        for (size_t i = 0; i < sub.size(); ++i) {
+            sub[i]->flatten(res);
+        }
+    }
+}
+
+const string& Item::id() {
+    if (!hasid) {
+        aid = anchor(kind == Kind::REF ? sval : flatten());
+        hasid = true;
+    }
+    return aid;
 }
 
 }
@@ -0,0 +1,244 @@
+/* JSONOutput.cc - implementation of the 'JSONOutput' class
+ *
+ * The tree is written as it is walked, so memory use doesn't depend on the size of the project. In
+ *   the content of items, 'JOIN' items are spliced into their parent, and adjacent text is merged into a
+ *   single string (which is kept open until something else is written)
+ *
+ * @author: Cade Brown <cade@kscript.org>
+ */
+
+#include <doq.hh>
+
+namespace doq {
+
+/* Names of each kind of item, indexed by 'Item::Kind' */
+static const char* kindnames[] = {
+    "join",
+    "math",
+    "mono",
+    "monoi",
+    "bold",
+    "italic",
+    "underline",
+    "ref",
+    "url",
+    "code",
+    "mathblock",
+    "note",
+    "list",
+    "dict",
+    "image",
+};
+
+/* Whether a byte has to be escaped in a JSON string */
+static struct Escapes {
+    bool c[256];
+    Escapes() {
+        for (int i = 0; i < 256; ++i) {
+            c[i] = i < 0x20 || i == '"' || i == '\\';
+        }
+    }
+} escapes;
+
+void JSONOutput::dump_esc(const char* data, size_t sz) {
+    static const char hex[] = "0123456789abcdef";
+    size_t i = 0;
+    while (i < sz) {
+        /* Copy the run of bytes that don't need escaping all at once */
+        size_t j = i;
+        while (j < sz && !escapes.c[(unsigned char)data[j]]) j++;
+        fp.write(data + i, j - i);
+        if (j >= sz) break;
+
+        char c = data[j];
+        if (c == '"') {
+            dump("\\\"");
+        } else if (c == '\\') {
+            dump("\\\\");
+        } else if (c == '\n') {
+            dump("\\n");
+        } else if (c == '\t') {
+            dump("\\t");
+        } else if (c == '\r') {
+            dump("\\r");
+        } else {
+            char tmp[6] = { '\\', 'u', '0', '0', hex[(c >> 4) & 0xF], hex[c & 0xF] };
+            fp.write(tmp, sizeof(tmp));
+        }
+        i = j + 1;
+    }
+}
+
+void JSONOutput::dump_str(const string& val) {
+    dump('"');
+    dump_esc(val);
+    dump('"');
+}
+
+void JSONOutput::dump_content(Item* item) {
+    /* Start a new array, and restore the state of the enclosing one afterwards */
+    bool lfirst = first, lintext = intext;
+    first = true;
+    intext = false;
+
+    dump('[');
+    dump_elems(item);
+    if (intext) dump('"');
+    dump(']');
+
+    first = lfirst;
+    intext = lintext;
+}
+
+void JSONOutput::dump_elems(Item* item) {
+    if (item->kind == Item::Kind::JOIN) {
+        dump_text(item->sval);
+        for (size_t i = 0; i < item->sub.size(); ++i) {
+            dump_elems(item->sub[i]);
+        }
+    } else {
+        dump_item(item);
+    }
+}
+
+void JSONOutput::dump_text(const string& val) {
+    if (val.size() == 0) return;
+    if (!intext) {
+        if (!first) dump(',');
+        first = false;
+        intext = true;
+        dump('"');
+    }
+    dump_esc(val);
+}
+
+void JSONOutput::dump_item(Item* item) {
+    if (intext) {
+        dump('"');
+        intext = false;
+    }
+    if (!first) dump(',');
+    first = false;
+
+    dump("{\"kind\":\"");
+    dump(kindnames[item->kind]);
+    dump('"');
+    if (item->sval.size() > 0) {
+        dump(",\"value\":");
+        dump_str(item->sval);
+    }
+    if (item->kind == Item::Kind::REF && item->target >= 0) {
+        dump(",\"target\":");
+        dump_str(proj->anchors[item->target].id);
+    }
+    if (item->ext >= 0) {
+        dump(",\"url\":");
+        dump_str(proj->externs[item->ext]);
+    }
+
+    if (item->kind == Item::Kind::LIST || item->kind == Item::Kind::DICT) {
+        /* Each element (or key and value, in turn) has its own content */
+        dump(",\"items\":[");
+        for (size_t i = 0; i < item->sub.size(); ++i) {
+            if (i > 0) dump(',');
+            dump_content(item->sub[i]);
+        }
+        dump(']');
+    } else if (item->sub.size() > 0) {
+        dump(",\"sub\":[");
+        bool lfirst = first;
+        first = true;
+        for (size_t i = 0; i < item->sub.size(); ++i) {
+            dump_elems(item->sub[i]);
+        }
+        if (intext) {
+            dump('"');
+            intext = false;
+        }
+        first = lfirst;
+        dump(']');
+    }
+    dump('}');
+}
+
+void JSONOutput::dump_head(Node* node) {
+    dump('{');
+    if (ndjson) {
+        dump("\"index\":");
+        dump(node->navi);
+        dump(",\"parent\":");
+        dump(node->par ? node->par->navi : -1);
+        dump(',');
+    }
+    dump("\"name\":");
+    dump_str(node->name);
+    dump(",\"id\":");
+    dump_str(node->id);
+    dump(",\"desc\":");
+    dump_str(node->desc);
+    dump(",\"secnum\":");
+    dump_str(node->secnum);
+    dump(",\"depth\":");
+    dump(node->depth);
+
+    dump(",\"contains\":[");
+    for (size_t i = 0; i < node->contains.size(); ++i) {
+        if (i > 0) dump(',');
+        dump_str(node->contains[i]);
+    }
+    dump("],\"content\":");
+    dump_content(node->val);
+}
+
+void JSONOutput::dump_node(Node* node) {
+    dump_head(node);
+    if (ndjson) {
+        dump("}\n");
+        for (size_t i = 0; i < node->sub.size(); ++i) {
+            dump_node(node->sub[i]);
+        }
+    } else {
+        dump(",\"children\":[");
+        for (size_t i = 0; i < node->sub.size(); ++i) {
+            if (i > 0) dump(',');
+            dump_node(node->sub[i]);
+        }
+        dump("]}");
+    }
+}
+
+void JSONOutput::init() {
+    mkdir(dest.c_str(), 0777);
+    fp.open(dest + (ndjson ? "/index.ndjson" : "/index.json"));
+}
+
+void JSONOutput::exec() {
+    if (!ndjson) {
+        dump("{\"project\":");
+        dump_str(proj->get("project")->flatten());
+        dump(",\"root\":");
+    }
+    if (!proj->streaming) {
+        dump_node(proj->root);
+    } else {
+        /* The top-level nodes weren't kept, so output each one as it is parsed again (as children of the
+         *   root, like 'dump_node()' would)
+         */
+        dump_head(proj->root);
+        dump(ndjson ? "}\n" : ",\"children\":[");
+        bool any = false;
+        proj->stream([this, &any](Node* node) {
+            if (!ndjson && any) dump(',');
+            any = true;
+            dump_node(node);
+        });
+        if (!ndjson) dump("]}");
+    }
+    if (!ndjson) dump("}\n");
+}
+
+void JSONOutput::fini() {
+    fp.close();
+}
+
+}
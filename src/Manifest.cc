@@ -0,0 +1,88 @@
+/* Manifest.cc - implementation of the 'doq::Manifest' type
+ *
+ * @author: Cade Brown <cade@kscript.org>
+ */
+
+#include <doq.hh>
+
+namespace doq {
+
+/* Name of the manifest file, in the output directory */
+static const char MANIFEST[] = ".doq-manifest";
+
+
+Manifest::Manifest(const string& dir_) : dir(dir_) {
+    ifstream ifs(dir + "/" + MANIFEST);
+    string line;
+    while (getline(ifs, line)) {
+        /* '<hash> <path>', where the hash is 16 hex digits */
+        if (line.size() < 18 || line[16] != ' ') continue;
+        old[line.substr(17)] = strtoull(line.substr(0, 16).c_str(), NULL, 16);
+    }
+}
+
+string Manifest::rel(const string& fname) {
+    if (fname.size() > dir.size() && fname.compare(0, dir.size(), dir) == 0 && fname[dir.size()] == '/') {
+        return fname.substr(dir.size() + 1);
+    }
+    return fname;
+}
+
+bool Manifest::changed(const string& fname, uint64_t hash, bool force) {
+    string r = rel(fname);
+    lock_guard<mutex> lock(mu);
+    cur[r] = hash;
+
+    map<string, uint64_t>::iterator it = old.find(r);
+    if (!force && it != old.end() && it->second == hash && access(fname.c_str(), F_OK) == 0) {
+        nsame++;
+        return false;
+    }
+    nwritten++;
+    return true;
+}
+
+void Manifest::finish() {
+    lock_guard<mutex> lock(mu);
+
+    /* Remove stale files (only ones doq wrote, so nothing else in the directory is touched) */
+    for (map<string, uint64_t>::iterator it = old.begin(); it != old.end(); ++it) {
+        if (cur.find(it->first) == cur.end()) {
+            string fname = dir + "/" + it->first;
+            if (unlink(fname.c_str()) == 0) {
+                nremoved++;
+            }
+            unlink((fname + Compressor::ext(Compressor::GZIP)).c_str());
+            unlink((fname + Compressor::ext(Compressor::BROTLI)).c_str());
+
+            /* Remove the directory too, if that was the last file in it (this fails otherwise) */
+            size_t slash = it->first.rfind('/');
+            if (slash != string::npos) {
+                rmdir((dir + "/" + it->first.substr(0, slash)).c_str());
+            }
+        }
+    }
+
+    /* Save it for the next build */
+    static const char hex[] = "0123456789abcdef";
+    string res;
+    for (map<string, uint64_t>::iterator it = cur.begin(); it != cur.end(); ++it) {
+        for (int i = 0; i < 16; ++i) {
+            res += hex[(it->second >> (60 - 4 * i)) & 0xF];
+        }
+        res += ' ';
+        res += it->first;
+        res += '\n';
+    }
+
+    string fname = dir + "/" + MANIFEST, tmp = fname + ".doq-tmp";
+    Writer fp;
+    fp.open(tmp);
+    fp.put(res);
+    fp.close();
+    if (rename(tmp.c_str(), fname.c_str()) != 0) {
+        throw runtime_error((string)"Failed to write '" + fname + "': " + strerror(errno));
+    }
+}
+
+}
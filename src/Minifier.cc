@@ -0,0 +1,294 @@
+/* Minifier.cc - implementation of the 'doq::Minifier' type
+ *
+ * This is a byte-at-a-time state machine, but each state has its own inner loop (and raw text and quoted
+ *   attribute values are copied with 'memchr()' and 'memcpy()'), so it isn't much slower than copying
+ *
+ * @author: Cade Brown <cade@kscript.org>
+ */
+
+#include <doq.hh>
+
+namespace doq {
+
+/* Character classes, looked up in a table so the inner loops stay small */
+enum {
+    C_PLAIN = 0,
+    C_SPACE,
+    C_NL,
+    C_LT,
+    C_GT,
+    C_QUOTE,
+};
+
+static struct Classes {
+    unsigned char c[256];
+    Classes() {
+        memset(c, C_PLAIN, sizeof(c));
+        c[(unsigned char)' '] = c[(unsigned char)'\t'] = c[(unsigned char)'\r'] = c[(unsigned char)'\f'] = C_SPACE;
+        c[(unsigned char)'\n'] = C_NL;
+        c[(unsigned char)'<'] = C_LT;
+        c[(unsigned char)'>'] = C_GT;
+        c[(unsigned char)'\''] = c[(unsigned char)'"'] = C_QUOTE;
+    }
+} classes;
+
+#define CLS(_c) (classes.c[(unsigned char)(_c)])
+
+/* Whether 'c' is whitespace in HTML */
+static bool isws(char c) {
+    return CLS(c) == C_SPACE || CLS(c) == C_NL;
+}
+
+/* Whether 'c' may start a tag name (after '<') */
+static bool istagstart(char c) {
+    return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || c == '/' || c == '!' || c == '?';
+}
+
+/* Tags (after '<') that change the state, and the kinds of elements they are checked in */
+static const struct {
+    const char* name;
+    int len;
+    Minifier::Raw in;
+} tags[] = {
+    { "!--", 3, Minifier::NONE },
+    { "pre", 3, Minifier::NONE },
+    { "script", 6, Minifier::NONE },
+    { "/pre", 4, Minifier::PRE },
+    { "/script", 7, Minifier::SCRIPT },
+};
+
+static const int ntags = sizeof(tags) / sizeof(*tags);
+
+/* Longest tag name, plus the '<' and the byte after the name */
+static const int maxtag = 9;
+
+/* Returns which tag 's' (starting with '<', and at least 'maxtag' bytes long) starts, or -1 for another tag
+ *   in 'raw' (and -2 for something that isn't a tag at all)
+ */
+static int quicktag(const char* s, Minifier::Raw raw) {
+    /* Most tags can be ruled out by the first byte */
+    char c = s[1];
+    if (raw == Minifier::NONE ? (c == '!' || c == 'p' || c == 's') : c == '/') {
+        for (int j = 0; j < ntags; ++j) {
+            if (tags[j].in == raw && memcmp(s + 1, tags[j].name, tags[j].len) == 0) {
+                char d = s[tags[j].len + 1];
+                if (j == 0 || isws(d) || d == '>' || d == '/') return j;
+            }
+        }
+    }
+    return raw == Minifier::NONE && istagstart(c) ? -1 : -2;
+}
+
+
+size_t Minifier::run(char* res, const char* x, size_t n) {
+    char* p = res;
+    size_t i = 0;
+
+    /* Work on local copies of the state, since 'p' might alias members */
+    State st = state;
+    int w = ws;
+
+    /* Output pending whitespace, and then pending bytes (except the last 'keep' of them) */
+    #define FLUSHPEND(_keep) do { \
+        if (w > 0) { \
+            *p++ = w == 2 ? '\n' : ' '; \
+            w = 0; \
+        } \
+        memcpy(p, pend, npend - (_keep)); \
+        p += npend - (_keep); \
+        npend = 0; \
+    } while (0)
+
+    while (i < n) {
+        switch (st) {
+        case TEXT:
+            if (raw != NONE) {
+                /* Copy everything up to the next tag */
+                const char* e = (const char*)memchr(x + i, '<', n - i);
+                size_t m = (e ? e - x : n) - i;
+                memcpy(p, x + i, m);
+                p += m;
+                i += m;
+                if (e) {
+                    st = LT;
+                }
+            } else {
+                /* Copy text, collapsing whitespace, up to the next tag */
+                while (i < n) {
+                    char c = x[i];
+                    int k = CLS(c);
+                    if (k == C_PLAIN || k >= C_GT) {
+                        if (w > 0) {
+                            *p++ = w == 2 ? '\n' : ' ';
+                            w = 0;
+                        }
+                        *p++ = c;
+                    } else if (k == C_SPACE) {
+                        if (w == 0) w = 1;
+                    } else if (k == C_NL) {
+                        w = 2;
+                    } else {
+                        st = LT;
+                        break;
+                    }
+                    i++;
+                }
+            }
+            if (st == LT) {
+                /* At a '<', which can usually be handled right away, unless it's too close to the end */
+                if (n - i >= maxtag) {
+                    int j = quicktag(x + i, raw);
+                    if (j == 0) {
+                        st = COMMENT;
+                        dashes = 0;
+                        i += 4;
+                    } else if (j == -2) {
+                        *p++ = '<';
+                        st = TEXT;
+                        i++;
+                    } else {
+                        if (j > 0) {
+                            raw = tags[j].in != NONE ? NONE : (tags[j].name[0] == 'p' ? PRE : SCRIPT);
+                        }
+                        if (w > 0) {
+                            *p++ = w == 2 ? '\n' : ' ';
+                            w = 0;
+                        }
+                        *p++ = '<';
+                        st = TAG;
+                        i++;
+                    }
+                } else {
+                    pend[0] = '<';
+                    npend = 1;
+                    i++;
+                }
+            }
+            break;
+
+        case LT: {
+            char c = x[i];
+            pend[npend++] = c;
+            i++;
+
+            /* Check the name so far against the tags that are still possible ('alive' is a bitmask) */
+            int nn = npend - 1;
+            if (nn == 1) {
+                alive = 0;
+                for (int j = 0; j < ntags; ++j) {
+                    if (tags[j].in == raw) alive |= 1 << j;
+                }
+            }
+            int now = 0;
+            for (int j = 0; j < ntags; ++j) {
+                if (!(alive & (1 << j))) continue;
+                if (nn <= tags[j].len) {
+                    if (tags[j].name[nn - 1] != c) continue;
+                    if (nn == tags[j].len && j == 0) {
+                        /* Start of a comment, so drop it */
+                        st = COMMENT;
+                        dashes = 0;
+                        npend = 0;
+                        goto next;
+                    }
+                    now |= 1 << j;
+                } else if (isws(c) || c == '>' || c == '/') {
+                    /* Whole name, so switch elements, and handle the last byte as part of the tag */
+                    raw = tags[j].in != NONE ? NONE : (tags[j].name[0] == 'p' ? PRE : SCRIPT);
+                    FLUSHPEND(1);
+                    st = TAG;
+                    i--;
+                    goto next;
+                }
+            }
+            alive = now;
+            if (!alive) {
+                /* Something else, so output it and handle the last byte again */
+                bool istag = raw == NONE && istagstart(pend[1]);
+                FLUSHPEND(1);
+                st = istag ? TAG : TEXT;
+                i--;
+            }
+            break;
+        }
+
+        case TAG:
+            /* Copy the tag, collapsing whitespace, up to its end or a quoted value */
+            while (i < n) {
+                char c = x[i++];
+                int k = CLS(c);
+                if (k == C_PLAIN || k == C_LT) {
+                    if (w > 0) {
+                        *p++ = ' ';
+                        w = 0;
+                    }
+                    *p++ = c;
+                } else if (k <= C_NL) {
+                    w = 1;
+                } else {
+                    if (w > 0 && k == C_QUOTE) {
+                        *p++ = ' ';
+                    }
+                    w = 0;
+                    *p++ = c;
+                    st = k == C_GT ? TEXT : (c == '\'' ? SQ : DQ);
+                    break;
+                }
+            }
+            break;
+
+        case SQ:
+        case DQ: {
+            /* Copy the rest of the attribute value */
+            const char* e = (const char*)memchr(x + i, st == SQ ? '\'' : '"', n - i);
+            size_t m = (e ? e - x + 1 : n) - i;
+            memcpy(p, x + i, m);
+            p += m;
+            i += m;
+            if (e) {
+                st = TAG;
+            }
+            break;
+        }
+
+        case COMMENT:
+            /* Skip to the end of the comment */
+            while (i < n) {
+                char c = x[i++];
+                if (c == '-') {
+                    dashes++;
+                } else if (c == '>' && dashes >= 2) {
+                    st = TEXT;
+                    break;
+                } else {
+                    dashes = 0;
+                }
+            }
+            break;
+        }
+        next:;
+    }
+
+    #undef FLUSHPEND
+    state = st;
+    ws = w;
+    return p - res;
+}
+
+size_t Minifier::finish(char* res) {
+    size_t r = 0;
+    if (state == LT) {
+        memcpy(res, pend, npend);
+        r = npend;
+    }
+
+    /* Trailing whitespace is dropped, and the state is reset for the next file */
+    state = TEXT;
+    raw = NONE;
+    ws = 0;
+    dashes = 0;
+    npend = 0;
+    return r;
+}
+
+}
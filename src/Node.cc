@@ -7,23 +7,33 @@
 
 namespace doq {
 
+void Node::finalize() {
+    for (size_t i = 0; i < sub.size(); ++i) {
+        finalize(sub[i], i);
+    }
+}
+
+void Node::finalize(Node* ch, size_t i) {
+    ch->id = anchor(ch->name);
+    ch->idx = i;
+    ch->depth = depth + 1;
+    if (ch->depth >= 2) {
+        ch->secnum = secnum + to_string(i + 1) + ".";
+    } else {
+        ch->secnum = "";
+    }
+    ch->finalize();
+}
+
 vector<int> Node::get_posi() {
     vector<int> res;
 
     /* Go upwards in the tree */
     Node* it = this;
     while (it && it->par) {
-        int r = -1;
-        for (size_t i = 0; i < it->par->sub.size(); ++i) {
-            if (it->par->sub[i] == it) {
-                r = i;
-                break;
-            }
-        }
-
-        /* We must have found it */
-        assert (r >= 0);
-        res.push_back(r);
+        /* Our index was recorded by 'finalize()' */
+        assert (it->par->sub[it->idx] == it);
+        res.push_back(it->idx);
 
         it = it->par;
     }
@@ -12,8 +12,14 @@ namespace doq {
 /** Internal Parsing routines **/
 
 
-/* Whether we are done */
-#define DONE (toki >= toks.size() - 1)
+/* Number of tokens lexed at a time when streaming, and how many must be left before lexing more (which
+ *   must be more than are ever consumed without checking 'DONE')
+ */
+#define LEXCHUNK 4096
+#define LEXAHEAD 16
+
+/* Whether we are done (when streaming, this also lexes more tokens if we are running out) */
+#define DONE ((lexer && toki + LEXAHEAD >= toks.size() ? lexer->lex(toks, LEXCHUNK) : (void)0), toki >= toks.size() - 1)
 
 /* Current Token */
 #define TOK (toks[toki])
@@ -37,6 +43,8 @@ namespace doq {
 Item* Project::parse_text(vector<Token>& toks, int& toki, bool stopsep) {
 
     Item* res = new Item(Item::Kind::JOIN);
+    res->line = TOK.line;
+    res->col = TOK.col;
     while (!DONE && !((TOK.kind == Token::Kind::RBRC && (!ismath || mathlbrc <= 0)) || (stopsep && (TOK.kind == Token::Kind::COM || TOK.kind == Token::Kind::NEWLINE)))) {
         if (TOK.kind == Token::Kind::LBRC && (!ismath)) {
             /* Block of input with '{}' */
@@ -58,21 +66,23 @@ Item* Project::parse_text(vector<Token>& toks, int& toki, bool stopsep) {
 
         } else if (TOK.kind == Token::Kind::CASH) {
             /* Internal reference */
-            EAT();
-            string ref = EAT().get(src);
+            Token at = EAT();
+            string ref = EAT().get(text);
 
             /* Create reference */
             Item* v = new Item(Item::Kind::REF, ref, { new Item(ref) });
+            v->line = at.line;
+            v->col = at.col;
 
             /* Add temporary to output */
             res->sub.push_back(v);
 
         } else if (TOK.kind == Token::Kind::AT) {
             /* Macro call */
-            EAT();
+            Token at = EAT();
 
             /* Get command being called */
-            string cmd = EAT().get(src);
+            string cmd = EAT().get(text);
             if (cmd == "@") {
                 /* @@ == escape code */
                 res->sub.push_back(new Item("@"));
@@ -99,6 +109,8 @@ Item* Project::parse_text(vector<Token>& toks, int& toki, bool stopsep) {
                 Node* ln = cur;
                 /* New node */         
                 Node* nn = new Node(pagename, pagedesc, v, ln);
+                nn->line = at.line;
+                nn->col = at.col;
 
                 /* Append new node */
                 ln->sub.push_back(nn);
@@ -113,6 +125,17 @@ Item* Project::parse_text(vector<Token>& toks, int& toki, bool stopsep) {
 
                 cur = ln;
 
+                if (ln == root && ontop) {
+                    /* Done with a top-level node, so hand it off and delete it, along with the tokens that
+                     *   were parsed (every frame shares 'toki', so they all see the change)
+                     */
+                    ontop(nn);
+                    ln->sub.pop_back();
+                    delete nn;
+                    toks.erase(toks.begin(), toks.begin() + toki);
+                    toki = 0;
+                }
+
                 /* Don't add to output, since it is a page */
 
             } else {
@@ -139,12 +162,18 @@ Item* Project::parse_text(vector<Token>& toks, int& toki, bool stopsep) {
 
                 /* Add temporary to output */
                 Item* v = call(cmd, args);
+                if (v->line < 0) {
+                    v->line = at.line;
+                    v->col = at.col;
+                }
 
                 res->sub.push_back(v);
 
-                /* TODO: free here? */
+                /* Macros copy what they keep, so the arguments can be freed (which matters when streaming,
+                 *   since otherwise memory would grow with the document)
+                 */
                 for (size_t i = 0; i < args.size(); ++i) {
-                //    delete args[i];
+                    delete args[i];
                 }
 
             }
@@ -158,13 +187,13 @@ Item* Project::parse_text(vector<Token>& toks, int& toki, bool stopsep) {
             if (TOK.kind == Token::Kind::NEWLINE) {
                 EAT();
             } else {
-                lang = EAT().get(src);
+                lang = EAT().get(text);
                 if (TOK.kind == Token::Kind::NEWLINE) EAT();
             }
 
             string code = "";
             while (!DONE && TOK.kind != Token::Kind::BBBQUOTE) {
-                code += EAT().get(src);
+                code += EAT().get(text);
             }
             if (TOK.kind != Token::Kind::BBBQUOTE) {
                 throw runtime_error("Expected '```' after code block");
@@ -173,6 +202,7 @@ Item* Project::parse_text(vector<Token>& toks, int& toki, bool stopsep) {
 
             /* Create code */
             Item* v = new Item(Item::Kind::CODE, lang, { new Item(code) });
+            langs[lang]++;
 
             res->sub.push_back(v);
 
@@ -182,7 +212,7 @@ Item* Project::parse_text(vector<Token>& toks, int& toki, bool stopsep) {
 
             string code = "";
             while (!DONE && TOK.kind != Token::Kind::BQUOTE) {
-                code += EAT().get(src);
+                code += EAT().get(text);
             }
             if (TOK.kind != Token::Kind::BQUOTE) {
                 throw runtime_error("Expected '`' after code block");
@@ -206,7 +236,7 @@ Item* Project::parse_text(vector<Token>& toks, int& toki, bool stopsep) {
                 mathlbrc--;
             }
 
-            res->sub.push_back(new Item(tok.get(src)));
+            res->sub.push_back(new Item(tok.get(text)));
             if (tok.kind == Token::Kind::NEWLINE) {
                 while (!DONE && TOK.kind == Token::Kind::NEWLINE) {
                     EAT();
@@ -218,6 +248,233 @@ Item* Project::parse_text(vector<Token>& toks, int& toki, bool stopsep) {
     return res;
 }
 
+int Project::index(Node* node, int par) {
+    int res = nav.size();
+    nav.push_back(NavEntry());
+    node->navi = res;
+
+    /* NOTE: 'nav' may be reallocated by the recursive calls, so don't keep references */
+    NavEntry& e = nav[res];
+    e.node = node;
+    e.name = node->name;
+    e.desc = node->desc;
+    e.secnum = node->secnum;
+    e.id = node->id;
+    e.depth = node->depth;
+    e.par = par;
+    e.contains = node->contains;
+    e.line = node->line;
+    e.col = node->col;
+    e.containspos = node->containspos;
+    for (size_t i = 0; i < node->contains.size(); ++i) {
+        e.containsid.push_back(anchor(node->contains[i]));
+    }
+
+    for (size_t i = 0; i < node->sub.size(); ++i) {
+        int c = index(node->sub[i], res);
+        nav[res].sub.push_back(c);
+    }
+
+    return res;
+}
+
+void Project::warn(int line, int col, const string& msg) {
+    warnings.push_back({ line, col, msg });
+}
+
+void Project::resolve() {
+    anchors.clear();
+    anchormap.clear();
+    edges.clear();
+
+    for (size_t i = 0; i < nav.size(); ++i) {
+        addanchors(i);
+    }
+
+    /* Now, resolve every reference in the content */
+    for (size_t i = 0; i < nav.size(); ++i) {
+        link(nav[i].node->val, i, false);
+    }
+
+    backlink();
+}
+
+void Project::addanchors(int navi) {
+    /* Add an anchor, and warn if it was already defined */
+    auto add = [&](const string& id, int ci, int line, int col) {
+        if (id.size() == 0) return;
+        pair<unordered_map<string, int>::iterator, bool> it = anchormap.insert(make_pair(id, (int)anchors.size()));
+        if (it.second) {
+            anchors.push_back({ id, navi, ci, line, col });
+        } else {
+            const Anchor& prev = anchors[it.first->second];
+            string msg = "duplicate anchor '" + id + "'";
+            if (prev.line >= 0) {
+                msg += " (first defined at " + to_string(prev.line + 1) + ":" + to_string(prev.col + 1) + ")";
+            }
+            warn(line, col, msg);
+        }
+    };
+
+    const NavEntry& e = nav[navi];
+    add(e.id, -1, e.line, e.col);
+    for (size_t j = 0; j < e.containsid.size(); ++j) {
+        add(e.containsid[j], j, e.containspos[j].first, e.containspos[j].second);
+    }
+}
+
+void Project::link(Item* val, int navi, bool defer) {
+    /* Returns the anchor 'id' if it was defined by entry 'navi' (and is the node itself if 'node' is given), or -1 */
+    auto own = [&](const string& id, bool node) {
+        unordered_map<string, int>::iterator f = anchormap.find(id);
+        if (f == anchormap.end()) return -1;
+        const Anchor& a = anchors[f->second];
+        return (a.navi == navi && (a.ci < 0) == node) ? f->second : -1;
+    };
+
+    /* References become (source anchor, target anchor) pairs, where the source is the innermost anchor
+     *   containing the reference (a node, or a '@cdict' entry). This is done without recursion, since content
+     *   may be deeply nested
+     */
+    vector<pair<Item*, int>> stk;
+    stk.push_back(make_pair(val, own(nav[navi].id, true)));
+    while (stk.size() > 0) {
+        Item* it = stk.back().first;
+        int from = stk.back().second;
+        stk.pop_back();
+        if (it->kind == Item::Kind::REF) {
+            unordered_map<string, int>::iterator f = anchormap.find(it->id());
+            if (f != anchormap.end()) {
+                it->target = f->second;
+                if (from >= 0 && from != f->second) {
+                    edges.push_back(make_pair(from, f->second));
+                }
+            } else if (defer) {
+                /* May be defined later, so keep its place in 'edges' */
+                it->target = -1;
+                int edge = -1;
+                if (from >= 0) {
+                    edge = edges.size();
+                    edges.push_back(make_pair(from, -1));
+                }
+                pending.push_back({ edge, it->sval, it->line, it->col });
+            } else {
+                it->target = -1;
+                it->ext = external(it->id());
+                if (it->ext < 0) {
+                    warn(it->line, it->col, "unresolved reference '" + it->sval + "'");
+                }
+            }
+        }
+
+        /* Push in reverse, so references are visited in source order */
+        for (size_t j = it->sub.size(); j > 0; --j) {
+            int subfrom = from;
+            if (it->kind == Item::Kind::DICT && (j - 1) % 2 == 1) {
+                /* Value of a dictionary entry, which is its own source if the key is an anchor from this node */
+                int k = own(it->sub[j - 2]->id(), false);
+                if (k >= 0) subfrom = k;
+            }
+            stk.push_back(make_pair(it->sub[j - 1], subfrom));
+        }
+    }
+}
+
+void Project::backlink() {
+    /* Invert the edges into 'backoff'/'backsrc' with a counting sort by target (skipping those without one) */
+    int na = anchors.size();
+    backoff.assign(na + 1, 0);
+    for (size_t i = 0; i < edges.size(); ++i) {
+        if (edges[i].second >= 0) {
+            backoff[edges[i].second + 1]++;
+        }
+    }
+    for (int i = 0; i < na; ++i) {
+        backoff[i + 1] += backoff[i];
+    }
+    backsrc.resize(backoff[na]);
+    vector<int> fill(backoff.begin(), backoff.end() - 1);
+    for (size_t i = 0; i < edges.size(); ++i) {
+        if (edges[i].second >= 0) {
+            backsrc[fill[edges[i].second]++] = edges[i].first;
+        }
+    }
+    edges.clear();
+    edges.shrink_to_fit();
+
+    /* Remove duplicate sources for each target, compacting in place ('seen[s] == t' if 's' was already added to 't') */
+    vector<int> seen(na, -1);
+    int out = 0;
+    for (int t = 0; t < na; ++t) {
+        int st = backoff[t], en = backoff[t + 1];
+        backoff[t] = out;
+        for (int j = st; j < en; ++j) {
+            int src = backsrc[j];
+            if (seen[src] != t) {
+                seen[src] = t;
+                backsrc[out++] = src;
+            }
+        }
+    }
+    backoff[na] = out;
+    backsrc.resize(out);
+}
+
+void Project::freeze() {
+    /* 'REF' items and dictionary keys are looked up by their ID ('flatten()' is only cached for what that
+     *   needs, since caching it everywhere would copy the text once per level of nesting)
+     */
+    vector<Item*> stk;
+    for (size_t i = 0; i < nav.size(); ++i) {
+        if (nav[i].node) stk.push_back(nav[i].node->val);
+    }
+    while (stk.size() > 0) {
+        Item* it = stk.back();
+        stk.pop_back();
+        if (it->kind == Item::Kind::REF) {
+            it->id();
+        } else if (it->kind == Item::Kind::DICT) {
+            for (size_t j = 0; j < it->sub.size(); j += 2) {
+                it->sub[j]->id();
+            }
+        }
+        stk.insert(stk.end(), it->sub.begin(), it->sub.end());
+    }
+
+    for (map<string, Item*>::iterator it = vars.begin(); it != vars.end(); ++it) {
+        it->second->flatten();
+    }
+    Item::empty->flatten();
+}
+
+const ImageCache::Image& Project::image(const string& path) {
+    return images.get(path.size() > 0 && path[0] == '/' ? path : srcdir + path);
+}
+
+int Project::external(const string& id) {
+    pair<unordered_map<string, int>::iterator, bool> it = externmap.insert(make_pair(id, -1));
+    if (it.second) {
+        string url;
+        for (size_t i = 0; i < inventories.size(); ++i) {
+            if (inventories[i]->find(id, url)) {
+                it.first->second = externs.size();
+                externs.push_back(url);
+                break;
+            }
+        }
+    }
+    return it.first->second;
+}
+
+const string& Project::anchorname(int i) {
+    const Anchor& a = anchors[i];
+    if (a.ci < 0) {
+        return nav[a.navi].name;
+    } else {
+        return nav[a.navi].contains[a.ci];
+    }
+}
+
 Item* Project::call(const string& name, const vector<Item*>& args) {
     map<string, Macro*>::iterator it = macros.find(name);
     if (it == macros.end()) {
@@ -249,16 +506,12 @@ void Project::set(const string& key, Item* val) {
         vars[key] = val->copy();
     } else {
         delete it->second;
-        it->second = val;
+        it->second = val->copy();
     }
 }
 
 
-/* Construct from file source */
-Project::Project(const string& src_) {
-    src = src_;
-    ismath = false;
-
+void Project::setup() {
     vars["project"] = new Item("ProjectName");
 
     /* Initialize functions & variables */
@@ -274,6 +527,7 @@ Project::Project(const string& src_) {
 
     macros["url"] = new Macro(macro::url);
     macros["ref"] = new Macro(macro::ref);
+    macros["image"] = new Macro(macro::image);
 
     macros["note"] = new Macro(macro::note);
 
@@ -300,21 +554,176 @@ Project::Project(const string& src_) {
 
     macros["note"] = new Macro(mf_note);
     */
+}
 
+void Project::parse() {
+    /* Transform into tokens (or, when streaming, lex them as they are needed) */
+    vector<Token> toks;
+    if (!lexer) {
+        toks = tokenize(src);
+    }
 
-    /* Transform into tokens */
-    vector<Token> toks = tokenize(src);
-
-    /* Create root node */
-    cur = root = new Node("", "", new Item(""));
-    
     /* Parse and append to root */
     int toki = 0;
     while (!DONE) {
         Item* v = parse_text(toks, toki);
         root->val->sub.push_back(v);
     }
+}
+
+/* Construct from file source */
+Project::Project(const string& src_, const vector<Inventory*>& invs) {
+    src = src_;
+    inventories = invs;
+    text = src.data();
+    size = src.size();
+    streaming = false;
+    lexer = NULL;
+    ismath = false;
+
+    setup();
+
+    /* Create root node */
+    cur = root = new Node("", "", new Item(""));
+
+    parse();
+
+    /* Compute positions and section numbers */
+    root->finalize();
 
+    /* Build the navigation index */
+    index(root, -1);
+
+    /* Resolve references */
+    resolve();
+
+}
+
+Project::Project(const char* text_, size_t size_, const vector<Inventory*>& invs) {
+    if (size_ > INT_MAX) {
+        throw runtime_error("Source is too large (the limit is 2GB)");
+    }
+    text = text_;
+    size = size_;
+    streaming = true;
+    inventories = invs;
+    lexer = new Lexer(text, size);
+    ismath = false;
+
+    setup();
+
+    /* Create root node, and its entry (its children are added as they are parsed) */
+    cur = root = new Node("", "", new Item(""));
+    index(root, -1);
+
+    /* Index each top-level node, resolving references to anchors defined so far (the rest are resolved
+     *   once everything has been seen), and then delete it
+     */
+    ontop = [this](Node* node) {
+        root->finalize(node, nav[0].sub.size());
+        int first = index(node, 0);
+        nav[0].sub.push_back(first);
+        for (size_t i = first; i < nav.size(); ++i) {
+            addanchors(i);
+        }
+        for (size_t i = first; i < nav.size(); ++i) {
+            link(nav[i].node->val, i, true);
+            nav[i].node = NULL;
+        }
+    };
+    parse();
+    ontop = nullptr;
+
+    /* Anchors in content outside of any node come last, since they aren't known until the end */
+    NavEntry& e = nav[0];
+    e.contains = root->contains;
+    e.containspos = root->containspos;
+    for (size_t i = 0; i < root->contains.size(); ++i) {
+        e.containsid.push_back(anchor(root->contains[i]));
+    }
+    addanchors(0);
+    link(root->val, 0, false);
+
+    /* Now, everything that can be resolved is defined */
+    for (size_t i = 0; i < pending.size(); ++i) {
+        const Pending& p = pending[i];
+        unordered_map<string, int>::iterator f = anchormap.find(anchor(p.name));
+        if (f != anchormap.end()) {
+            if (p.edge >= 0 && edges[p.edge].first != f->second) {
+                edges[p.edge].second = f->second;
+            }
+        } else if (external(anchor(p.name)) < 0) {
+            warn(p.line, p.col, "unresolved reference '" + p.name + "'");
+        }
+    }
+    pending.clear();
+    pending.shrink_to_fit();
+
+    backlink();
+}
+
+void Project::stream(const function<void(Node*)>& fn) {
+    assert(streaming);
+
+    /* Start over, since macros (like '@set') run again */
+    for (map<string, Item*>::iterator it = vars.begin(); it != vars.end(); ++it) {
+        delete it->second;
+    }
+    vars.clear();
+    vars["project"] = new Item("ProjectName");
+    langs.clear();
+    ismath = false;
+    cur = root;
+    delete lexer;
+    lexer = new Lexer(text, size);
+
+    size_t k = 0;
+    ontop = [&](Node* node) {
+        root->finalize(node, k);
+
+        /* Entries are in pre-order, so walk the tree in the same order to find them */
+        int navi = nav[0].sub[k++];
+        vector<Node*> nstk = { node };
+        vector<Item*> stk;
+        while (nstk.size() > 0) {
+            Node* n = nstk.back();
+            nstk.pop_back();
+            n->navi = navi++;
+            for (size_t j = n->sub.size(); j > 0; --j) {
+                nstk.push_back(n->sub[j - 1]);
+            }
+
+            /* Resolve references (which were already checked) */
+            stk.push_back(n->val);
+            while (stk.size() > 0) {
+                Item* it = stk.back();
+                stk.pop_back();
+                if (it->kind == Item::Kind::REF) {
+                    unordered_map<string, int>::iterator f = anchormap.find(it->id());
+                    it->target = f != anchormap.end() ? f->second : -1;
+                    it->ext = it->target < 0 ? external(it->id()) : -1;
+                }
+                stk.insert(stk.end(), it->sub.begin(), it->sub.end());
+            }
+        }
+
+        fn(node);
+    };
+
+    /* Content outside of any node was kept the first time, so throw it away */
+    Item* val = root->val;
+    root->val = new Item("");
+    try {
+        parse();
+    } catch (...) {
+        delete root->val;
+        root->val = val;
+        ontop = nullptr;
+        throw;
+    }
+    delete root->val;
+    root->val = val;
+    ontop = nullptr;
 }
 
 
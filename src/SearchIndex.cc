@@ -0,0 +1,145 @@
+/* SearchIndex.cc - implementation of the 'doq::SearchIndex' type
+ *
+ * The index is written as one file per 2-byte term prefix, so the browser only loads the shards for the
+ *   terms being searched. Files are JavaScript (a JSON payload passed to a callback) rather than plain JSON,
+ *   so they can be loaded with '<script>' tags, which also works for pages opened from disk
+ *
+ * @author: Cade Brown <cade@kscript.org>
+ */
+
+#include <doq.hh>
+#include <thread>
+
+namespace doq {
+
+/* Whether 'c' is part of a term (bytes of multi-byte UTF-8 characters are included) */
+static bool isterm(char c) {
+    return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || ('0' <= c && c <= '9') || c == '_' || (c & 0x80);
+}
+
+void SearchIndex::add(int doc, const char* x, size_t n) {
+    size_t i = 0;
+    while (i < n) {
+        while (i < n && !isterm(x[i])) i++;
+        size_t st = i;
+        while (i < n && isterm(x[i])) i++;
+
+        /* Single characters are too common to be useful */
+        if (i - st < 2) continue;
+
+        tmp.assign(x + st, i - st);
+        for (size_t j = 0; j < tmp.size(); ++j) {
+            if ('A' <= tmp[j] && tmp[j] <= 'Z') tmp[j] += 'a' - 'A';
+        }
+
+        vector<Posting>& p = terms[tmp];
+        if (p.size() > 0 && p.back().doc == doc) {
+            p.back().tf++;
+        } else {
+            p.push_back({ doc, 1 });
+        }
+    }
+}
+
+string SearchIndex::shard(const string& term) {
+    static const char hex[] = "0123456789abcdef";
+    string res;
+    for (size_t i = 0; i < 2 && i < term.size(); ++i) {
+        unsigned char c = term[i];
+        res += hex[c >> 4];
+        res += hex[c & 0xF];
+    }
+    return res;
+}
+
+void SearchIndex::write(const string& dir, const vector<pair<string, string>>& docs) {
+    mkdir(dir.c_str(), 0777);
+
+    /* Document list (anchor ID and title) */
+    string res = "doq_search_docs([";
+    for (size_t i = 0; i < docs.size(); ++i) {
+        if (i > 0) res += ',';
+        res += '[';
+        jsonstr(res, docs[i].first);
+        res += ',';
+        jsonstr(res, docs[i].second);
+        res += ']';
+    }
+    res += "]);\n";
+
+    Writer fp;
+    fp.manifest = manifest;
+    fp.files = files;
+    fp.open(dir + "/docs.js");
+    fp.compress(compress);
+    fp.put(res);
+    fp.close();
+
+    /* Group terms by shard */
+    unordered_map<string, vector<Term*>> groups;
+    for (unordered_map<string, vector<Posting>>::iterator it = terms.begin(); it != terms.end(); ++it) {
+        groups[shard(it->first)].push_back(&*it);
+    }
+    vector<pair<const string, vector<Term*>>*> shards;
+    for (unordered_map<string, vector<Term*>>::iterator it = groups.begin(); it != groups.end(); ++it) {
+        shards.push_back(&*it);
+    }
+
+    /* Write shards in parallel, each thread taking every 'nt'th shard */
+    int nt = max(1, min((int)thread::hardware_concurrency(), (int)shards.size()));
+    vector<thread> threads;
+    vector<string> errs(nt);
+    for (int t = 0; t < nt; ++t) {
+        threads.push_back(thread([&, t]() {
+            try {
+                Writer out;
+                out.manifest = manifest;
+                out.files = files;
+                string buf;
+                for (size_t k = t; k < shards.size(); k += nt) {
+                    const string& key = shards[k]->first;
+                    vector<Term*>& ts = shards[k]->second;
+                    sort(ts.begin(), ts.end(), [](const Term* a, const Term* b) {
+                        return a->first < b->first;
+                    });
+
+                    buf = "doq_search_load(\"" + key + "\",{";
+                    for (size_t i = 0; i < ts.size(); ++i) {
+                        /* A document may appear more than once (content around a '@cdict'), so merge them */
+                        vector<Posting>& p = ts[i]->second;
+                        sort(p.begin(), p.end(), [](const Posting& a, const Posting& b) { return a.doc < b.doc; });
+
+                        if (i > 0) buf += ',';
+                        jsonstr(buf, ts[i]->first);
+                        buf += ":[";
+                        for (size_t j = 0; j < p.size(); ) {
+                            int doc = p[j].doc, tf = 0;
+                            while (j < p.size() && p[j].doc == doc) tf += p[j++].tf;
+                            if (buf.back() != '[') buf += ',';
+                            buf += to_string(doc);
+                            buf += ',';
+                            buf += to_string(tf);
+                        }
+                        buf += ']';
+                    }
+                    buf += "});\n";
+
+                    out.open(dir + "/" + key + ".js");
+                    out.compress(compress);
+                    out.put(buf);
+                    out.close();
+                }
+            } catch (exception& e) {
+                errs[t] = e.what();
+            }
+        }));
+    }
+    for (int t = 0; t < nt; ++t) {
+        threads[t].join();
+    }
+    for (int t = 0; t < nt; ++t) {
+        if (errs[t].size() > 0) throw runtime_error(errs[t]);
+    }
+}
+
+}
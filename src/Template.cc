@@ -0,0 +1,46 @@
+/* Template.cc - implementation of the 'doq::Template' type
+ *
+ * Slots are written as '{{name}}' (the name can't contain '}'), and everything else is copied as-is
+ *
+ * @author: Cade Brown <cade@kscript.org>
+ */
+
+#include <doq.hh>
+
+namespace doq {
+
+Template::Template(const string& fname_) : fname(fname_), text(readall(fname_)) {
+    size_t i = 0, line = 1;
+    while (true) {
+        size_t st = text.find("{{", i);
+        if (st == string::npos) {
+            segs.push_back({ i, text.size() - i, -1 });
+            break;
+        }
+        line += count(text.begin() + i, text.begin() + st, '\n');
+        size_t en = text.find("}}", st + 2);
+        if (en == string::npos || memchr(text.data() + st + 2, '\n', en - st - 2)) {
+            throw runtime_error(fname + ":" + to_string(line) + ": unterminated slot in template");
+        }
+
+        /* Slots with the same name share an ID */
+        string name = text.substr(st + 2, en - st - 2);
+        int slot = find(slots.begin(), slots.end(), name) - slots.begin();
+        if (slot == (int)slots.size()) {
+            slots.push_back(name);
+        }
+        segs.push_back({ i, st - i, slot });
+        i = en + 2;
+    }
+}
+
+void Template::render(Writer& fp, const vector<function<void()>>& fill) const {
+    for (size_t i = 0; i < segs.size(); ++i) {
+        fp.write(text.data() + segs[i].off, segs[i].len);
+        if (segs[i].slot >= 0) {
+            fill[segs[i].slot]();
+        }
+    }
+}
+
+}
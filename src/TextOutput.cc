@@ -9,10 +9,32 @@
 
 namespace doq {
 
-void TextOutput::ind() {
-    for (size_t i = 0; i < indstk.size(); ++i) {
-        dump(indstk[i]);
+/* Returns the relative path from the file 'from' to the file 'to' (both relative to the same directory) */
+static string relpath(const string& from, const string& to) {
+    /* Go up from the directory of 'from' to the common one, and then down to 'to' */
+    size_t common = 0;
+    for (size_t i = 0; i < from.size() && i < to.size() && from[i] == to[i]; ++i) {
+        if (from[i] == '/') common = i + 1;
+    }
+    string res;
+    for (size_t i = common; i < from.size(); ++i) {
+        if (from[i] == '/') res += "../";
     }
+    return res + to.substr(common);
+}
+
+void TextOutput::ind() {
+    dump(indent);
+}
+
+void TextOutput::pushind(const char* x) {
+    indlens.push_back(indent.size());
+    indent += x;
+}
+
+void TextOutput::popind() {
+    indent.resize(indlens.back());
+    indlens.pop_back();
 }
 
 void TextOutput::dump_item(Item* item) {
@@ -48,8 +70,16 @@ void TextOutput::dump_item(Item* item) {
         for (size_t i = 0; i < item->sub.size(); ++i) {
             dump_item(item->sub[i]);
         }
-        dump("](#");
-        dump(item->sval);
+        if (item->ext >= 0) {
+            dump("](");
+            dump(proj->externs[item->ext]);
+        } else if (split && item->target >= 0) {
+            dump("](");
+            dump(link(item->target));
+        } else {
+            dump("](#");
+            dump(item->sval);
+        }
         dump(")");
         break;
 
@@ -63,6 +93,19 @@ void TextOutput::dump_item(Item* item) {
         dump(")");
         break;
 
+    case Item::Kind::IMAGE: {
+        const ImageCache::Image& img = proj->image(item->sval);
+        images[img.name] = &img;
+        dump("![");
+        for (size_t i = 0; i < item->sub.size(); ++i) {
+            dump_item(item->sub[i]);
+        }
+        dump("](");
+        dump(split ? relpath(paths[curnavi], img.name) : img.name);
+        dump(")");
+        break;
+    }
+
     case Item::Kind::CODE:
         dump("\n```");
         dump(item->sval);
@@ -98,14 +141,14 @@ void TextOutput::dump_item(Item* item) {
 
     case Item::Kind::LIST:
         dump("\n");
-        indstk.push_back("  ");
+        pushind("  ");
         for (size_t i = 0; i < item->sub.size(); ++i) {
             ind();
             dump("* ");
             dump_item(item->sub[i]);
-            if (i < item->sub.size() - 1 || indstk.size() <= 1) dump("\n");
+            if (i < item->sub.size() - 1 || indlens.size() <= 1) dump("\n");
         }
-        indstk.pop_back();
+        popind();
         break;
 
     case Item::Kind::DICT:
@@ -119,11 +162,11 @@ void TextOutput::dump_item(Item* item) {
 
             } else {
                 /* Value */
-                indstk.push_back(": ");
+                pushind(": ");
                 ind();
                 dump_item(item->sub[i]);
-                indstk.pop_back();
-                if (i < item->sub.size() - 1 || indstk.size() <= 1) dump("\n");
+                popind();
+                if (i < item->sub.size() - 1 || indlens.size() <= 1) dump("\n");
             }
         }
         break;
@@ -139,21 +182,16 @@ void TextOutput::dump_item(Item* item) {
 }
 
 void TextOutput::dump_node(Node* node) {
-    vector<int> idxs = node->get_posi();
-
     /* If we are not the root node */
-    if (idxs.size() > 0) {
+    if (node->depth > 0) {
         /* Output header */
-        for (size_t i = 1; i < idxs.size(); ++i) {
+        for (int i = 1; i < node->depth; ++i) {
             dump("#");
         }
         dump(" ");
 
         /* Output a section ID */
-        for (size_t i = 1; i < idxs.size(); ++i) {
-            dump(idxs[i] + 1);
-            dump(".");
-        }
+        dump(node->secnum);
 
         /* And the name */
         dump(" ");
@@ -172,17 +210,157 @@ void TextOutput::dump_node(Node* node) {
 }
 
 
+/* Returns the name of a file or directory for a node named 'name', which only has characters that are safe
+ *   in paths and links
+ */
+static string pathname(const string& name) {
+    string res = anchor(name);
+    for (size_t i = 0; i < res.size(); ++i) {
+        char c = res[i];
+        if (!(isalnum((unsigned char)c) || c == '_' || c == '-' || c == '.' || (unsigned char)c >= 0x80)) {
+            res[i] = '_';
+        }
+    }
+    if (res.size() == 0 || res[0] == '.') {
+        res = "_" + res;
+    }
+    return res;
+}
+
+void TextOutput::makepaths() {
+    /* Each node is '<name>.md', and its children are in the directory '<name>' next to it (the root is
+     *   'index.md', with the top-level nodes next to it). Since 'nav' is in pre-order, parents come first
+     */
+    const vector<NavEntry>& nav = proj->nav;
+    vector<string> stems(nav.size());
+    paths.resize(nav.size());
+    paths[0] = "index.md";
+    for (size_t i = 0; i < nav.size(); ++i) {
+        /* Names used by the children so far, so duplicates can be numbered */
+        unordered_map<string, int> used;
+        if (i == 0) {
+            used["index"] = 1;
+        } else if (nav[i].sub.size() > 0) {
+            mkdir((dest + "/" + stems[i]).c_str(), 0777);
+        }
+        for (size_t j = 0; j < nav[i].sub.size(); ++j) {
+            int ch = nav[i].sub[j];
+            string name = pathname(nav[ch].name);
+            int n = ++used[name];
+            if (n > 1) {
+                name += "-" + to_string(n);
+            }
+            stems[ch] = i == 0 ? name : stems[i] + "/" + name;
+            paths[ch] = stems[ch] + ".md";
+        }
+    }
+}
+
+string TextOutput::link(int anchor) {
+    const Anchor& a = proj->anchors[anchor];
+    string res;
+    if (a.navi != curnavi) {
+        res = relpath(paths[curnavi], paths[a.navi]);
+    }
+    if (a.ci >= 0 || res.size() == 0) {
+        res += "#" + a.id;
+    }
+    return res;
+}
+
+void TextOutput::dump_page(int navi) {
+    curnavi = navi;
+    const NavEntry& e = proj->nav[navi];
+    fp.open(dest + "/" + paths[navi]);
+
+    if (navi > 0) {
+        dump("# ");
+        if (e.secnum.size() > 0) {
+            dump(e.secnum);
+            dump(" ");
+        }
+        dump(e.name);
+        dump("\n");
+    }
+    dump_item(e.node->val);
+
+    /* Link to the children, which are in their own files */
+    if (e.sub.size() > 0) {
+        dump("\n");
+        for (size_t i = 0; i < e.sub.size(); ++i) {
+            const NavEntry& c = proj->nav[e.sub[i]];
+            dump("* [");
+            if (c.secnum.size() > 0) {
+                dump(c.secnum);
+                dump(" ");
+            }
+            dump(c.name);
+            dump("](");
+            dump(relpath(paths[navi], paths[e.sub[i]]));
+            dump(")\n");
+        }
+    }
+    fp.close();
+}
+
 void TextOutput::init() {
     mkdir(dest.c_str(), 0777);
-    fp.open(dest + "/index.md", ios::out);
+    if (!split) {
+        fp.open(dest + "/index.md");
+    }
 }
 
 void TextOutput::exec() {
-    dump_node(proj->root);
+    if (!split) {
+        dump_node(proj->root);
+        return;
+    }
+    if (proj->nav.size() > 0 && !proj->nav[0].node) {
+        throw runtime_error("Split Markdown output can't be written when streaming");
+    }
+    makepaths();
+
+    /* Render pages in parallel, each thread (with its own output state) taking every 'nt'th page */
+    int nt = max(1, min((int)thread::hardware_concurrency(), (int)proj->nav.size()));
+    vector<thread> threads;
+    vector<string> errs(nt);
+    mutex mu;
+    for (int t = 0; t < nt; ++t) {
+        threads.push_back(thread([&, t]() {
+            try {
+                TextOutput out(proj, dest);
+                out.split = true;
+                out.paths = paths;
+                for (size_t i = t; i < proj->nav.size(); i += nt) {
+                    out.dump_page(i);
+                }
+                lock_guard<mutex> lock(mu);
+                images.insert(out.images.begin(), out.images.end());
+            } catch (exception& e) {
+                errs[t] = e.what();
+            }
+        }));
+    }
+    for (int t = 0; t < nt; ++t) {
+        threads[t].join();
+    }
+    for (int t = 0; t < nt; ++t) {
+        if (errs[t].size() > 0) {
+            throw runtime_error(errs[t]);
+        }
+    }
 }
 
 void TextOutput::fini() {
     fp.close();
+
+    /* Images (which, since their names depend on the contents, are only copied if they aren't there) */
+    for (map<string, const ImageCache::Image*>::iterator it = images.begin(); it != images.end(); ++it) {
+        string fname = dest + "/" + it->first;
+        if (access(fname.c_str(), F_OK) != 0) {
+            copyfile(fname, it->second->src);
+        }
+    }
 }
 
 }
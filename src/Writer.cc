@@ -0,0 +1,341 @@
+/* Writer.cc - implementation of the 'doq::Writer' type
+ *
+ * @author: Cade Brown <cade@kscript.org>
+ */
+
+#include <doq.hh>
+
+namespace doq {
+
+/* Pairs of decimal digits, for formatting two at a time */
+static const char digits2[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+
+/* Write all of 'iov', retrying on partial writes */
+static void writeall(int fd, struct iovec* iov, int niov) {
+    while (niov > 0) {
+        ssize_t rc = writev(fd, iov, niov);
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            throw runtime_error((string)"Failed to write output: " + strerror(errno));
+        }
+
+        /* Skip what was written */
+        size_t n = rc;
+        while (niov > 0 && n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            niov--;
+        }
+        if (niov > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+
+void Writer::open(const string& fname_) {
+    close();
+    fname = fname_;
+    if (manifest && !spool) {
+        /* Nothing is written until we know whether it changed */
+        inmem = true;
+        return;
+    }
+    if (manifest) {
+        /* Written to the side, until we know whether it changed */
+        spooling = true;
+        hash = hash64(NULL, 0);
+        fd = ::open((fname_ + ".doq-tmp").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0) {
+            spooling = false;
+            throw runtime_error((string)"Unknown file: " + fname_);
+        }
+        return;
+    }
+    fd = ::open(fname_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        throw runtime_error((string)"Unknown file: " + fname_);
+    }
+}
+
+void Writer::close() {
+    if (inmem) {
+        closemem();
+    } else if (spooling) {
+        closespool();
+    } else if (fd >= 0) {
+        /* Write the rest, which is also the last chunk for the compressors */
+        const char* data = buf;
+        size_t sz = len;
+        if (filter) {
+            sz = filter->run(fbuf, buf, len);
+            sz += filter->finish(fbuf + sz);
+            data = fbuf;
+        }
+        struct iovec iov = { (void*)data, sz };
+        writeall(fd, &iov, 1);
+        len = 0;
+
+        ::close(fd);
+        fd = -1;
+        finishcomps(data, sz);
+    }
+
+    /* Filters and compression only apply to a single file */
+    delete filter;
+    filter = NULL;
+    kinds = 0;
+}
+
+void Writer::closemem() {
+    inmem = false;
+    const char* data = buf;
+    size_t sz = len;
+    len = 0;
+    if (filter) {
+        /* The buffer may have grown since the filter was added */
+        fbuf = (char*)realloc(fbuf, cap + Minifier::SLACK);
+        sz = filter->run(fbuf, buf, sz);
+        sz += filter->finish(fbuf + sz);
+        data = fbuf;
+    }
+
+    /* Also write it if a compressed copy is missing (for example, if it wasn't requested last time) */
+    bool missing = false;
+    for (int k = Compressor::GZIP; k <= Compressor::BROTLI; k <<= 1) {
+        if ((kinds & k) && access((fname + Compressor::ext((Compressor::Kind)k)).c_str(), F_OK) != 0) {
+            missing = true;
+        }
+    }
+    if (!manifest->changed(fname, hash64(data, sz), missing)) return;
+
+    if (files) {
+        /* Written later, along with other files */
+        files->add(fname, data, sz);
+        finishcomps(data, sz);
+        return;
+    }
+
+    /* Write to a temporary file, and then rename it, so readers never see a partial file */
+    string tmp = fname + ".doq-tmp";
+    fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        throw runtime_error((string)"Unknown file: " + fname);
+    }
+    struct iovec iov = { (void*)data, sz };
+    try {
+        writeall(fd, &iov, 1);
+    } catch (exception& e) {
+        ::close(fd);
+        fd = -1;
+        unlink(tmp.c_str());
+        throw;
+    }
+    ::close(fd);
+    fd = -1;
+    if (rename(tmp.c_str(), fname.c_str()) != 0) {
+        unlink(tmp.c_str());
+        throw runtime_error((string)"Failed to write '" + fname + "': " + strerror(errno));
+    }
+
+    finishcomps(data, sz);
+}
+
+void Writer::closespool() {
+    /* Write the rest */
+    try {
+        if (filter) {
+            size_t sz = filter->run(fbuf, buf, len);
+            sz += filter->finish(fbuf + sz);
+            emit(fbuf, sz);
+        } else {
+            emit(buf, len);
+        }
+    } catch (exception& e) {
+        ::close(fd);
+        fd = -1;
+        unlink((fname + ".doq-tmp").c_str());
+        spooling = false;
+        throw;
+    }
+    len = 0;
+    ::close(fd);
+    fd = -1;
+    spooling = false;
+
+    string tmp = fname + ".doq-tmp";
+    bool missing = false;
+    for (int k = Compressor::GZIP; k <= Compressor::BROTLI; k <<= 1) {
+        if ((kinds & k) && access((fname + Compressor::ext((Compressor::Kind)k)).c_str(), F_OK) != 0) {
+            missing = true;
+        }
+    }
+    if (!manifest->changed(fname, hash, missing)) {
+        unlink(tmp.c_str());
+        return;
+    }
+    if (rename(tmp.c_str(), fname.c_str()) != 0) {
+        unlink(tmp.c_str());
+        throw runtime_error((string)"Failed to write '" + fname + "': " + strerror(errno));
+    }
+
+    if (kinds) {
+        /* Compress it now that we know it is needed, reading it back a buffer at a time */
+        int in = ::open(fname.c_str(), O_RDONLY);
+        if (in < 0) {
+            throw runtime_error((string)"Unknown file: " + fname);
+        }
+        startcomps();
+        ssize_t n;
+        while ((n = ::read(in, buf, cap)) != 0) {
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                ::close(in);
+                finishcomps(NULL, 0);
+                throw runtime_error((string)"Failed to read '" + fname + "': " + strerror(errno));
+            }
+            for (size_t i = 0; i < comps.size(); ++i) {
+                comps[i]->feed(buf, n);
+            }
+        }
+        ::close(in);
+        finishcomps(NULL, 0);
+    }
+}
+
+void Writer::minify() {
+    if (!filter) {
+        filter = new Minifier();
+        if (!fbuf) fbuf = (char*)malloc(cap + Minifier::SLACK);
+    }
+}
+
+void Writer::compress(int kinds_) {
+    kinds = kinds_;
+}
+
+void Writer::startcomps() {
+    if (comps.size() == 0) {
+        for (int k = Compressor::GZIP; k <= Compressor::BROTLI; k <<= 1) {
+            if (kinds & k) {
+                comps.push_back(new Compressor(fname, (Compressor::Kind)k));
+            }
+        }
+    }
+}
+
+void Writer::finishcomps(const char* data, size_t sz) {
+    startcomps();
+    string err;
+    for (size_t i = 0; i < comps.size(); ++i) {
+        try {
+            comps[i]->finish(data, sz);
+        } catch (exception& e) {
+            err = e.what();
+        }
+        delete comps[i];
+    }
+    comps.clear();
+    if (err.size() > 0) {
+        throw runtime_error(err);
+    }
+}
+
+void Writer::emit(const char* data, size_t sz) {
+    struct iovec iov = { (void*)data, sz };
+    writeall(fd, &iov, 1);
+    if (spooling) {
+        /* Compressed copies are only made once we know it changed */
+        hash = hash64(data, sz, hash);
+        return;
+    }
+    startcomps();
+    for (size_t i = 0; i < comps.size(); ++i) {
+        comps[i]->feed(data, sz);
+    }
+}
+
+void Writer::flush() {
+    if (inmem) {
+        /* Kept until 'close()' */
+        return;
+    }
+    if (len > 0 && fd >= 0) {
+        if (filter) {
+            emit(fbuf, filter->run(fbuf, buf, len));
+        } else {
+            emit(buf, len);
+        }
+    }
+    len = 0;
+}
+
+void Writer::spill(const char* data, size_t sz) {
+    if (inmem) {
+        /* Grow the buffer to hold the whole file */
+        cap = max(cap * 2, len + sz);
+        buf = (char*)realloc(buf, cap);
+        memcpy(buf + len, data, sz);
+        len += sz;
+    } else if (sz < cap / 2) {
+        /* Small enough, so flush and buffer it */
+        flush();
+        memcpy(buf, data, sz);
+        len = sz;
+    } else if (fd >= 0 && (filter || kinds || spooling)) {
+        /* Large chunk, which has to go through the filter a buffer at a time (which is also what the
+         *   compressors and the hash want)
+         */
+        flush();
+        for (size_t i = 0; i < sz; i += cap) {
+            size_t n = min(cap, sz - i);
+            if (filter) {
+                emit(fbuf, filter->run(fbuf, data + i, n));
+            } else {
+                emit(data + i, n);
+            }
+        }
+    } else if (fd >= 0) {
+        /* Large chunk, so write it along with the buffer in a single call */
+        struct iovec iov[2] = { { buf, len }, { (void*)data, sz } };
+        writeall(fd, iov, 2);
+        len = 0;
+    } else {
+        len = 0;
+    }
+}
+
+void Writer::putu(unsigned long long x) {
+    /* Format backwards, two digits at a time */
+    char tmp[24];
+    char* p = tmp + sizeof(tmp);
+    while (x >= 100) {
+        int r = (x % 100) * 2;
+        x /= 100;
+        *--p = digits2[r + 1];
+        *--p = digits2[r];
+    }
+    if (x >= 10) {
+        int r = x * 2;
+        *--p = digits2[r + 1];
+        *--p = digits2[r];
+    } else {
+        *--p = '0' + x;
+    }
+
+    write(p, tmp + sizeof(tmp) - p);
+}
+
+}
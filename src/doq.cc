@@ -8,21 +8,233 @@
 using namespace doq;
 
 int main(int argc, char** argv) {
-    if (argc < 1 + 2) {
-        throw runtime_error("Usage: doq [file] [output]");
+    /* Positional arguments */
+    vector<string> pos;
+
+    /* Whether warnings should fail the build */
+    bool strict = false;
+
+    /* Whether to output "Referenced by" lists */
+    bool backlinks = false;
+
+    /* Whether to output a search index */
+    bool search = false;
+
+    /* Whether to minify HTML */
+    bool minify = false;
+
+    /* Kinds of compressed copies to write (see 'Compressor::Kind') */
+    int compress = 0;
+
+    /* Whether to stream the input, for documents too large to keep parsed in memory */
+    bool stream = false;
+
+    /* Output formats, if given with '--formats' (in which case each is written to its own subdirectory) */
+    vector<string> formats;
+
+    /* Page template for HTML, if given with '--template' */
+    string tmpl;
+
+    /* Whether to write Markdown as one file per node */
+    bool split = false;
+
+    /* Inventories of other projects, given with '--inventory', as the file and the URL their URLs are
+     *   relative to
+     */
+    vector<pair<string, string>> invnames;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--strict") {
+            strict = true;
+        } else if (arg == "--backlinks") {
+            backlinks = true;
+        } else if (arg == "--search") {
+            search = true;
+        } else if (arg == "--minify") {
+            minify = true;
+        } else if (arg == "--stream") {
+            stream = true;
+        } else if (arg == "--split") {
+            split = true;
+        } else if (arg == "--formats") {
+            if (i + 1 >= argc) {
+                throw runtime_error("Option '--formats' requires a list of formats, like 'html,md'");
+            }
+            string list = argv[++i];
+            size_t st = 0;
+            while (st <= list.size()) {
+                size_t en = list.find(',', st);
+                if (en == string::npos) en = list.size();
+                string name = list.substr(st, en - st);
+                if (name.size() > 0 && find(formats.begin(), formats.end(), name) == formats.end()) {
+                    formats.push_back(name);
+                }
+                st = en + 1;
+            }
+        } else if (arg == "--template") {
+            if (i + 1 >= argc) {
+                throw runtime_error("Option '--template' requires a file, like 'page.html'");
+            }
+            tmpl = argv[++i];
+        } else if (arg == "--inventory") {
+            if (i + 1 >= argc) {
+                throw runtime_error("Option '--inventory' requires a file, like '../other/out/doq.inv=https://example.org/other/'");
+            }
+            /* The URLs are relative to the given base, or else to the directory the inventory is in */
+            string val = argv[++i];
+            size_t eq = val.find('=');
+            if (eq != string::npos) {
+                invnames.push_back(make_pair(val.substr(0, eq), val.substr(eq + 1)));
+            } else {
+                size_t sl = val.rfind('/');
+                invnames.push_back(make_pair(val, sl == string::npos ? "" : val.substr(0, sl + 1)));
+            }
+        } else if (arg == "--gzip" || arg == "--brotli") {
+            Compressor::Kind kind = arg == "--gzip" ? Compressor::GZIP : Compressor::BROTLI;
+            if (!Compressor::supported(kind)) {
+                throw runtime_error("Option '" + arg + "' is not available, rebuild doq with 'make " + (kind == Compressor::GZIP ? "ZLIB=1" : "BROTLI=1") + "'");
+            }
+            compress |= kind;
+        } else if (arg.size() > 2 && arg.substr(0, 2) == "--") {
+            throw runtime_error("Unknown option: " + arg);
+        } else {
+            pos.push_back(arg);
+        }
+    }
+
+    if (pos.size() != 2) {
+        throw runtime_error("Usage: doq [--strict] [--backlinks] [--search] [--minify] [--gzip] [--brotli] [--stream] [--split] [--formats html,md] [--template page.html] [--inventory doq.inv[=url]] [file] [output]");
     }
 
-    /* Create project form input file */
-    string src = readall(argv[1]);
-    Project* proj = new Project(src);
+    /* Check the formats before doing any work */
+    bool subdirs = formats.size() > 0;
+    if (!subdirs) {
+        formats.push_back("html");
+    }
+    for (size_t i = 0; i < formats.size(); ++i) {
+        if (formats[i] != "html" && formats[i] != "md" && formats[i] != "json" && formats[i] != "ndjson" && formats[i] != "bin") {
+            throw runtime_error("Unknown format: '" + formats[i] + "' (expected 'html', 'md', 'json', 'ndjson', or 'bin')");
+        }
+    }
+    if (stream && (formats.size() > 1 || formats[0] == "md" || formats[0] == "bin")) {
+        throw runtime_error("Option '--stream' only supports a single format, of 'html', 'json', or 'ndjson'");
+    }
 
-    /* Output */
-    //Output* out = new TextOutput(proj, argv[2]);
-    Output* out = new HTMLOutput(proj, argv[2]);
-    out->init();
-    out->exec();
-    out->fini();
+    /* Load inventories of other projects (which are mapped, so this is quick however large they are) */
+    vector<Inventory*> invs;
+    for (size_t i = 0; i < invnames.size(); ++i) {
+        invs.push_back(new Inventory(invnames[i].first, invnames[i].second));
+    }
+
+    /* Create project form input file (which, when streaming, is mapped instead of read) */
+    Project* proj;
+    char* mapped = NULL;
+    size_t size = 0;
+    if (stream) {
+        mapped = mapall(pos[0], size);
+        proj = new Project(mapped, size, invs);
+    } else {
+        string src = readall(pos[0]);
+        proj = new Project(src, invs);
+    }
+
+    /* Paths in the source are relative to it */
+    size_t sl = pos[0].rfind('/');
+    proj->srcdir = sl == string::npos ? "" : pos[0].substr(0, sl + 1);
+
+    /* Report problems found in the project */
+    for (size_t i = 0; i < proj->warnings.size(); ++i) {
+        const Diagnostic& d = proj->warnings[i];
+        const char* kind = strict ? "error" : "warning";
+        if (d.line >= 0) {
+            fprintf(stderr, "%s:%d:%d: %s: %s\n", pos[0].c_str(), d.line + 1, d.col + 1, kind, d.msg.c_str());
+        } else {
+            fprintf(stderr, "%s: %s: %s\n", pos[0].c_str(), kind, d.msg.c_str());
+        }
+    }
+    if (strict && proj->warnings.size() > 0) {
+        fprintf(stderr, "doq: %d problem(s) found, not writing output (--strict)\n", (int)proj->warnings.size());
+        delete proj;
+        for (size_t i = 0; i < invs.size(); ++i) {
+            delete invs[i];
+        }
+        if (mapped) unmapall(mapped, size);
+        return 1;
+    }
+
+    /* Outputs */
+    if (subdirs) {
+        mkdir(pos[1].c_str(), 0777);
+    }
+    vector<Output*> outs;
+    for (size_t i = 0; i < formats.size(); ++i) {
+        string dest = subdirs ? pos[1] + "/" + formats[i] : pos[1];
+        if (formats[i] == "html") {
+            HTMLOutput* out = new HTMLOutput(proj, dest);
+            out->backlinks = backlinks;
+            out->dosearch = search;
+            out->minify = minify;
+            out->compress = compress;
+            out->tmplpath = tmpl;
+            outs.push_back(out);
+        } else if (formats[i] == "json" || formats[i] == "ndjson") {
+            outs.push_back(new JSONOutput(proj, dest, formats[i] == "ndjson"));
+        } else if (formats[i] == "bin") {
+            outs.push_back(new BinaryOutput(proj, dest));
+        } else {
+            TextOutput* out = new TextOutput(proj, dest);
+            out->split = split;
+            outs.push_back(out);
+        }
+    }
+
+    /* Run each output (they only read the project, so once it is frozen, they can all run at once) */
+    vector<string> errs(outs.size());
+    auto run = [&](size_t i) {
+        try {
+            outs[i]->init();
+            outs[i]->exec();
+            outs[i]->fini();
+        } catch (exception& e) {
+            errs[i] = e.what();
+        }
+    };
+    if (outs.size() == 1) {
+        run(0);
+    } else {
+        proj->freeze();
+        vector<thread> workers;
+        for (size_t i = 0; i < outs.size(); ++i) {
+            workers.push_back(thread(run, i));
+        }
+        for (size_t i = 0; i < workers.size(); ++i) {
+            workers[i].join();
+        }
+    }
+    for (size_t i = 0; i < errs.size(); ++i) {
+        if (errs[i].size() > 0) {
+            throw runtime_error(errs[i]);
+        }
+    }
+
+    int nwritten = 0, nsame = 0, nremoved = 0;
+    for (size_t i = 0; i < outs.size(); ++i) {
+        Manifest* m = outs[i]->manifest;
+        if (m) {
+            nwritten += m->nwritten;
+            nsame += m->nsame;
+            nremoved += m->nremoved;
+        }
+    }
+    fprintf(stderr, "doq: %d file(s) written, %d unchanged, %d removed\n", nwritten, nsame, nremoved);
 
     delete proj;
-    delete out;
+    for (size_t i = 0; i < outs.size(); ++i) {
+        delete outs[i];
+    }
+    for (size_t i = 0; i < invs.size(); ++i) {
+        delete invs[i];
+    }
+    if (mapped) unmapall(mapped, size);
 }
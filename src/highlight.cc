@@ -0,0 +1,302 @@
+/* highlight.cc - build-time syntax highlighting of code blocks
+ *
+ * Highlighting is table-driven: each language is a 'Grammar' of word lists and lexical rules, and a single
+ *   generic scanner is used for all of them. The output uses the same 'hljs-*' classes that highlight.js
+ *   does, so existing stylesheets keep working without any JavaScript
+ * 
+ * @author: Cade Brown <cade@kscript.org>
+ */
+
+#include <doq.hh>
+
+namespace doq {
+
+
+/** kscript **/
+
+/* Language keywords */
+static const char* ks_keywords[] = {
+    "with", "del", "import", "from", "as", "in",
+    "assert", "break", "cont",
+    "type", "func", "extends",
+    "if", "elif", "else",
+    "while",
+    "for",
+    "try", "catch", "finally",
+    "ret", "throw",
+    NULL
+};
+
+/* Literal values (similar to keywords) */
+static const char* ks_literals[] = {
+    "...",
+    "false", "true",
+    "none",
+    "undefined",
+    "inf", "nan",
+    NULL
+};
+
+/* Builtin names */
+static const char* ks_builtins[] = {
+    "__argv", "__stdin", "__stdout", "__stderr",
+    "object", "number", "int", "enum", "bool", "float", "complex", "str", "bytes",
+    "range", "slice", "tuple", "list", "set", "dict",
+    "abs", "pow", "min", "max", "sum",
+    "bin", "oct", "hex",
+    "ord", "chr",
+    "compile", "eval", "exec",
+    "enumerate", "filter", "map", "zip", "all", "any",
+    "iter", "next", "len", "hash", "id", "repr", "print", "printf",
+    "isinst", "issub",
+    "input", "exit",
+    NULL
+};
+
+/* Adds a NULL-terminated list of words to 'g' with the given class */
+static void addwords(Grammar* g, const char** words, const char* cls) {
+    for (int i = 0; words[i]; ++i) {
+        g->words[words[i]] = cls;
+    }
+}
+
+/* Creates the kscript grammar (see 'assets/hljs-ks.js', which this mirrors) */
+static Grammar* ks_grammar() {
+    Grammar* g = new Grammar();
+    g->name = "kscript";
+    g->aliases = { "ks", "kscript" };
+
+    addwords(g, ks_keywords, "keyword");
+    addwords(g, ks_literals, "literal");
+    addwords(g, ks_builtins, "built_in");
+
+    g->titles = { "func", "type" };
+    g->comment = "#";
+    g->strings = { "'''", "\"\"\"", "'", "\"" };
+    g->prompts = { ">>> ", "... " };
+    g->reprs = true;
+    g->numbers = true;
+
+    return g;
+}
+
+
+/** Registry **/
+
+/* Adds 'g' to 'reg', under its name and aliases */
+static void addto(unordered_map<string, Grammar*>& reg, Grammar* g) {
+    reg[g->name] = g;
+    for (size_t i = 0; i < g->aliases.size(); ++i) {
+        reg[g->aliases[i]] = g;
+    }
+}
+
+/* Returns the map of language names to grammars, creating the builtin grammars the first time (which is
+ *   safe even if outputs on several threads get there at once, since it is a local static)
+ */
+static unordered_map<string, Grammar*>& registry() {
+    static unordered_map<string, Grammar*> res = []() {
+        unordered_map<string, Grammar*> reg;
+        addto(reg, ks_grammar());
+        return reg;
+    }();
+    return res;
+}
+
+void add_grammar(Grammar* g) {
+    addto(registry(), g);
+}
+
+Grammar* get_grammar(const string& lang) {
+    unordered_map<string, Grammar*>& reg = registry();
+    unordered_map<string, Grammar*>::iterator it = reg.find(lang);
+    return it == reg.end() ? NULL : it->second;
+}
+
+
+/** Highlighting **/
+
+/* Whether 'c' can start an identifier */
+static bool isidstart(char c) {
+    return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || c == '_';
+}
+
+/* Whether 'c' can be inside an identifier */
+static bool isid(char c) {
+    return isidstart(c) || ('0' <= c && c <= '9');
+}
+
+/* Whether 'c' is a digit in base 'base' */
+static bool isdigitb(char c, int base) {
+    if (base == 2) return c == '0' || c == '1';
+    if (base == 8) return '0' <= c && c <= '7';
+    if (base == 16) return ('0' <= c && c <= '9') || ('a' <= c && c <= 'f') || ('A' <= c && c <= 'F');
+    return '0' <= c && c <= '9';
+}
+
+/* Appends 'n' bytes of 'x', HTML-escaped, wrapped in a span of class 'hljs-<cls>' */
+static void span(string& res, const char* cls, const char* x, size_t n) {
+    res += "<span class='hljs-";
+    res += cls;
+    res += "'>";
+    htmlesc(res, x, n);
+    res += "</span>";
+}
+
+/* Returns the length of the number starting at 's[i]', or 0 if there is none */
+static size_t numlen(const string& s, size_t i) {
+    size_t n = s.size(), j = i;
+    int base = 10;
+
+    if (s[j] == '0' && j + 1 < n) {
+        char p = s[j + 1];
+        if (p == 'b' || p == 'B') base = 2;
+        else if (p == 'o' || p == 'O') base = 8;
+        else if (p == 'x' || p == 'X') base = 16;
+        if (base != 10 || p == 'd' || p == 'D') j += 2;
+    }
+
+    size_t st = j;
+    while (j < n && isdigitb(s[j], base)) j++;
+    if (j < n && s[j] == '.' && j + 1 < n && isdigitb(s[j + 1], base)) {
+        j++;
+        while (j < n && isdigitb(s[j], base)) j++;
+    }
+    if (j == st) return 0;
+
+    /* Exponent ('p' for non-decimal bases, since 'e' is a hex digit) */
+    char e = base == 10 ? 'e' : 'p';
+    if (j < n && (s[j] == e || s[j] == e - 'a' + 'A')) {
+        size_t k = j + 1;
+        if (k < n && (s[k] == '+' || s[k] == '-')) k++;
+        if (k < n && '0' <= s[k] && s[k] <= '9') {
+            while (k < n && '0' <= s[k] && s[k] <= '9') k++;
+            j = k;
+        }
+    }
+
+    /* Imaginary */
+    if (j < n && (s[j] == 'i' || s[j] == 'I')) j++;
+
+    /* Must end on a word boundary */
+    if (j < n && isid(s[j])) return 0;
+    return j - i;
+}
+
+void highlight(string& res, Grammar* g, const string& code) {
+    const char* s = code.data();
+    size_t n = code.size();
+
+    /* Whether the next identifier is a title */
+    bool wanttitle = false;
+
+    size_t i = 0;
+    while (i < n) {
+        char c = s[i];
+        bool linestart = i == 0 || s[i - 1] == '\n';
+
+        /* Prompts */
+        if (linestart) {
+            bool found = false;
+            for (size_t j = 0; j < g->prompts.size() && !found; ++j) {
+                const string& p = g->prompts[j];
+                if (code.compare(i, p.size(), p) == 0) {
+                    span(res, "meta", s + i, p.size());
+                    i += p.size();
+                    found = true;
+                }
+            }
+            if (found) continue;
+
+            if (g->reprs && c == '<' && i + 1 < n && isid(s[i + 1])) {
+                size_t j = i + 1;
+                while (j < n && isid(s[j])) j++;
+                span(res, "meta", s + i, j - i);
+                i = j;
+                continue;
+            }
+        }
+
+        /* Comments */
+        if (g->comment.size() > 0 && code.compare(i, g->comment.size(), g->comment) == 0) {
+            size_t j = i;
+            while (j < n && s[j] != '\n') j++;
+            span(res, "comment", s + i, j - i);
+            i = j;
+            wanttitle = false;
+            continue;
+        }
+
+        /* Strings */
+        bool found = false;
+        for (size_t j = 0; j < g->strings.size() && !found; ++j) {
+            const string& d = g->strings[j];
+            if (code.compare(i, d.size(), d) == 0) {
+                size_t k = i + d.size();
+                while (k < n && code.compare(k, d.size(), d) != 0) {
+                    k += (s[k] == '\\' && k + 1 < n) ? 2 : 1;
+                }
+                k = min(n, k + d.size());
+                span(res, "string", s + i, k - i);
+                i = k;
+                found = true;
+            }
+        }
+        if (found) {
+            wanttitle = false;
+            continue;
+        }
+
+        /* Numbers */
+        if (g->numbers && '0' <= c && c <= '9' && (i == 0 || !isid(s[i - 1]))) {
+            size_t l = numlen(code, i);
+            if (l > 0) {
+                span(res, "number", s + i, l);
+                i += l;
+                wanttitle = false;
+                continue;
+            }
+        }
+
+        /* Identifiers and words */
+        if (isidstart(c)) {
+            size_t j = i;
+            while (j < n && isid(s[j])) j++;
+            string word(s + i, j - i);
+
+            unordered_map<string, string>::iterator it = g->words.find(word);
+            if (wanttitle) {
+                span(res, "title", s + i, j - i);
+                wanttitle = false;
+            } else if (it != g->words.end()) {
+                span(res, it->second.c_str(), s + i, j - i);
+                wanttitle = find(g->titles.begin(), g->titles.end(), word) != g->titles.end();
+            } else {
+                res.append(s + i, j - i);
+            }
+            i = j;
+            continue;
+        }
+
+        /* Symbols that are words (like '...') */
+        if (c == '.' && code.compare(i, 3, "...") == 0 && g->words.count("...")) {
+            span(res, g->words["..."].c_str(), s + i, 3);
+            i += 3;
+            continue;
+        }
+
+        /* End of an object repr */
+        if (g->reprs && c == '>' && (i + 1 >= n || s[i + 1] == '\n')) {
+            span(res, "meta", s + i, 1);
+            i++;
+            continue;
+        }
+
+        /* Anything else is passed along */
+        if (c != ' ' && c != '\t') wanttitle = false;
+        htmlesc(res, s + i, 1);
+        i++;
+    }
+}
+
+}
@@ -13,7 +13,10 @@ Item* get(Project* proj, const vector<Item*>& args) {
         MACRO_ERROR("'@get' requires 1 argument");
     }
 
-    return proj->get(args[0]->flatten());
+    /* A copy, since the result is owned by the content it is added to (which may be deleted first, when
+     *   streaming)
+     */
+    return proj->get(args[0]->flatten())->copy();
 }
 
 Item* set(Project* proj, const vector<Item*>& args) {
@@ -89,6 +92,19 @@ Item* ref(Project* proj, const vector<Item*>& args) {
 }
 
 
+Item* image(Project* proj, const vector<Item*>& args) {
+    if (args.size() == 0) {
+        MACRO_ERROR("'@image' requires at least 1 argument");
+    }
+
+    vector<Item*> sub;
+    for (size_t i = 1; i < args.size(); ++i) {
+        sub.push_back(args[i]->copy());
+    }
+    return new Item(Item::Kind::IMAGE, args[0]->flatten(), sub);
+}
+
+
 Item* mono(Project* proj, const vector<Item*>& args) {
     Item* res = new Item(Item::Kind::MONO);
     for (size_t i = 0; i < args.size(); ++i) {
@@ -150,7 +166,7 @@ Item* dict(Project* proj, const vector<Item*>& args) {
     Item* res = new Item(Item::Kind::DICT);
     for (size_t i = 0; i < args.size(); ++i) {
         if (i % 2 == 0) {
-            string flat = args[i]->flatten();
+            const string& flat = args[i]->flatten();
             if (flat.size() == 0) {
                 i++;
                 continue;
@@ -166,7 +182,7 @@ Item* cdict(Project* proj, const vector<Item*>& args) {
     Item* res = new Item(Item::Kind::DICT);
     for (size_t i = 0; i < args.size(); ++i) {
         if (i % 2 == 0) {
-            string flat = args[i]->flatten();
+            const string& flat = args[i]->flatten();
             if (flat.size() == 0) {
                 i++;
                 continue;
@@ -174,6 +190,7 @@ Item* cdict(Project* proj, const vector<Item*>& args) {
             if (proj->cur) {
                 /* Add reference */
                 proj->cur->contains.push_back(flat);
+                proj->cur->containspos.push_back(make_pair(args[i]->line, args[i]->col));
             }
         }
         res->sub.push_back(args[i]->copy());
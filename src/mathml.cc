@@ -0,0 +1,484 @@
+/* mathml.cc - conversion of TeX math to MathML
+ *
+ * This handles the commonly used subset of TeX (fractions, roots, sub/superscripts, Greek letters, operators,
+ *   '\left'/'\right', matrices, and text), so pages don't need to typeset math in the browser. Anything
+ *   outside that subset makes the conversion fail, and the caller should fall back to passing the TeX along
+ * 
+ * @author: Cade Brown <cade@kscript.org>
+ */
+
+#include <doq.hh>
+
+namespace doq {
+
+/* Kind of symbol a command produces */
+enum SymKind {
+    /* Identifier, '<mi>' */
+    SYM_MI,
+    /* Upright identifier, '<mi mathvariant='normal'>' */
+    SYM_MIN,
+    /* Function name, '<mi>' (multi-letter, so upright) */
+    SYM_FUNC,
+    /* Operator, '<mo>' */
+    SYM_MO,
+    /* Large operator with limits, '<mo>' with under/over scripts */
+    SYM_LARGE,
+};
+
+/* Symbol produced by a command */
+struct Sym {
+    SymKind kind;
+    const char* text;
+};
+
+/* Returns the table of commands that produce a single symbol */
+static const unordered_map<string, Sym>& symbols() {
+    static const unordered_map<string, Sym> res = {
+        /* Greek (lowercase) */
+        { "alpha", { SYM_MI, "α" } }, { "beta", { SYM_MI, "β" } }, { "gamma", { SYM_MI, "γ" } },
+        { "delta", { SYM_MI, "δ" } }, { "epsilon", { SYM_MI, "ϵ" } }, { "varepsilon", { SYM_MI, "ε" } },
+        { "zeta", { SYM_MI, "ζ" } }, { "eta", { SYM_MI, "η" } }, { "theta", { SYM_MI, "θ" } },
+        { "vartheta", { SYM_MI, "ϑ" } }, { "iota", { SYM_MI, "ι" } }, { "kappa", { SYM_MI, "κ" } },
+        { "lambda", { SYM_MI, "λ" } }, { "mu", { SYM_MI, "μ" } }, { "nu", { SYM_MI, "ν" } },
+        { "xi", { SYM_MI, "ξ" } }, { "pi", { SYM_MI, "π" } }, { "varpi", { SYM_MI, "ϖ" } },
+        { "rho", { SYM_MI, "ρ" } }, { "varrho", { SYM_MI, "ϱ" } }, { "sigma", { SYM_MI, "σ" } },
+        { "varsigma", { SYM_MI, "ς" } }, { "tau", { SYM_MI, "τ" } }, { "upsilon", { SYM_MI, "υ" } },
+        { "phi", { SYM_MI, "ϕ" } }, { "varphi", { SYM_MI, "φ" } }, { "chi", { SYM_MI, "χ" } },
+        { "psi", { SYM_MI, "ψ" } }, { "omega", { SYM_MI, "ω" } },
+
+        /* Greek (uppercase, upright) */
+        { "Gamma", { SYM_MIN, "Γ" } }, { "Delta", { SYM_MIN, "Δ" } }, { "Theta", { SYM_MIN, "Θ" } },
+        { "Lambda", { SYM_MIN, "Λ" } }, { "Xi", { SYM_MIN, "Ξ" } }, { "Pi", { SYM_MIN, "Π" } },
+        { "Sigma", { SYM_MIN, "Σ" } }, { "Upsilon", { SYM_MIN, "Υ" } }, { "Phi", { SYM_MIN, "Φ" } },
+        { "Psi", { SYM_MIN, "Ψ" } }, { "Omega", { SYM_MIN, "Ω" } },
+
+        /* Other identifiers */
+        { "infty", { SYM_MIN, "∞" } }, { "partial", { SYM_MIN, "∂" } }, { "nabla", { SYM_MIN, "∇" } },
+        { "ell", { SYM_MI, "ℓ" } }, { "hbar", { SYM_MI, "ℏ" } }, { "emptyset", { SYM_MIN, "∅" } },
+
+        /* Functions */
+        { "sin", { SYM_FUNC, "sin" } }, { "cos", { SYM_FUNC, "cos" } }, { "tan", { SYM_FUNC, "tan" } },
+        { "sec", { SYM_FUNC, "sec" } }, { "csc", { SYM_FUNC, "csc" } }, { "cot", { SYM_FUNC, "cot" } },
+        { "arcsin", { SYM_FUNC, "arcsin" } }, { "arccos", { SYM_FUNC, "arccos" } }, { "arctan", { SYM_FUNC, "arctan" } },
+        { "sinh", { SYM_FUNC, "sinh" } }, { "cosh", { SYM_FUNC, "cosh" } }, { "tanh", { SYM_FUNC, "tanh" } },
+        { "log", { SYM_FUNC, "log" } }, { "ln", { SYM_FUNC, "ln" } }, { "exp", { SYM_FUNC, "exp" } },
+        { "det", { SYM_FUNC, "det" } }, { "dim", { SYM_FUNC, "dim" } }, { "gcd", { SYM_FUNC, "gcd" } },
+        { "deg", { SYM_FUNC, "deg" } }, { "arg", { SYM_FUNC, "arg" } }, { "mod", { SYM_FUNC, "mod" } },
+
+        /* Operators and relations */
+        { "cdot", { SYM_MO, "⋅" } }, { "times", { SYM_MO, "×" } }, { "div", { SYM_MO, "÷" } },
+        { "pm", { SYM_MO, "±" } }, { "mp", { SYM_MO, "∓" } }, { "ast", { SYM_MO, "∗" } },
+        { "circ", { SYM_MO, "∘" } }, { "le", { SYM_MO, "≤" } }, { "leq", { SYM_MO, "≤" } },
+        { "ge", { SYM_MO, "≥" } }, { "geq", { SYM_MO, "≥" } }, { "ne", { SYM_MO, "≠" } },
+        { "neq", { SYM_MO, "≠" } }, { "approx", { SYM_MO, "≈" } }, { "equiv", { SYM_MO, "≡" } },
+        { "sim", { SYM_MO, "∼" } }, { "propto", { SYM_MO, "∝" } }, { "ll", { SYM_MO, "≪" } },
+        { "gg", { SYM_MO, "≫" } }, { "in", { SYM_MO, "∈" } }, { "notin", { SYM_MO, "∉" } },
+        { "subset", { SYM_MO, "⊂" } }, { "subseteq", { SYM_MO, "⊆" } }, { "supset", { SYM_MO, "⊃" } },
+        { "supseteq", { SYM_MO, "⊇" } }, { "cup", { SYM_MO, "∪" } }, { "cap", { SYM_MO, "∩" } },
+        { "setminus", { SYM_MO, "∖" } }, { "forall", { SYM_MO, "∀" } }, { "exists", { SYM_MO, "∃" } },
+        { "neg", { SYM_MO, "¬" } }, { "land", { SYM_MO, "∧" } }, { "wedge", { SYM_MO, "∧" } },
+        { "lor", { SYM_MO, "∨" } }, { "vee", { SYM_MO, "∨" } }, { "oplus", { SYM_MO, "⊕" } },
+        { "otimes", { SYM_MO, "⊗" } }, { "to", { SYM_MO, "→" } }, { "rightarrow", { SYM_MO, "→" } },
+        { "leftarrow", { SYM_MO, "←" } }, { "Rightarrow", { SYM_MO, "⇒" } }, { "Leftarrow", { SYM_MO, "⇐" } },
+        { "leftrightarrow", { SYM_MO, "↔" } }, { "iff", { SYM_MO, "⇔" } }, { "implies", { SYM_MO, "⟹" } },
+        { "mapsto", { SYM_MO, "↦" } }, { "mid", { SYM_MO, "∣" } }, { "ldots", { SYM_MO, "…" } },
+        { "cdots", { SYM_MO, "⋯" } }, { "dots", { SYM_MO, "…" } }, { "vdots", { SYM_MO, "⋮" } },
+        { "ddots", { SYM_MO, "⋱" } }, { "langle", { SYM_MO, "⟨" } }, { "rangle", { SYM_MO, "⟩" } },
+        { "lfloor", { SYM_MO, "⌊" } }, { "rfloor", { SYM_MO, "⌋" } }, { "lceil", { SYM_MO, "⌈" } },
+        { "rceil", { SYM_MO, "⌉" } }, { "{", { SYM_MO, "{" } }, { "}", { SYM_MO, "}" } },
+        { "|", { SYM_MO, "‖" } },
+
+        /* Large operators */
+        { "sum", { SYM_LARGE, "∑" } }, { "prod", { SYM_LARGE, "∏" } }, { "coprod", { SYM_LARGE, "∐" } },
+        { "bigcup", { SYM_LARGE, "⋃" } }, { "bigcap", { SYM_LARGE, "⋂" } }, { "lim", { SYM_LARGE, "lim" } },
+        { "max", { SYM_LARGE, "max" } }, { "min", { SYM_LARGE, "min" } }, { "sup", { SYM_LARGE, "sup" } },
+        { "inf", { SYM_LARGE, "inf" } },
+
+        /* Integrals (scripts go to the side) */
+        { "int", { SYM_MO, "∫" } }, { "iint", { SYM_MO, "∬" } }, { "iiint", { SYM_MO, "∭" } },
+        { "oint", { SYM_MO, "∮" } },
+    };
+    return res;
+}
+
+/* Returns the width of a spacing command, or NULL if 'cmd' is not one */
+static const char* spacewidth(const string& cmd) {
+    if (cmd == ",") return "0.167em";
+    if (cmd == ":" || cmd == ">") return "0.222em";
+    if (cmd == ";") return "0.278em";
+    if (cmd == " ") return "0.25em";
+    if (cmd == "quad") return "1em";
+    if (cmd == "qquad") return "2em";
+    return NULL;
+}
+
+/* Converter state for a single formula */
+struct TeX {
+
+    /* TeX source, and position in it */
+    const string& s;
+    size_t i;
+
+    /* Whether ']' ends a group (inside '\sqrt[...]') */
+    bool inbrk;
+
+    TeX(const string& s_) : s(s_), i(0), inbrk(false) {}
+
+    /* Skip whitespace */
+    void skip() {
+        while (i < s.size() && (s[i] == ' ' || s[i] == '\t' || s[i] == '\n' || s[i] == '\r')) i++;
+    }
+
+    /* Whether 'x' is next */
+    bool next(const char* x) {
+        return s.compare(i, strlen(x), x) == 0;
+    }
+
+    /* Whether the end of a group is next ('}', '&', '\\', '\end', '\right', or the end of input) */
+    bool atend() {
+        skip();
+        return i >= s.size() || s[i] == '}' || s[i] == '&' || (inbrk && s[i] == ']') || next("\\\\") || next("\\end") || next("\\right");
+    }
+
+    /* Read a command name after '\' (letters, or a single other character) */
+    string command() {
+        size_t st = i;
+        while (i < s.size() && isalpha((unsigned char)s[i])) i++;
+        if (i == st && i < s.size()) i++;
+        return s.substr(st, i - st);
+    }
+
+    /* Read a '{...}' group as raw text (for '\text', '\begin', etc.) */
+    bool rawgroup(string& res) {
+        skip();
+        if (i >= s.size() || s[i] != '{') return false;
+        size_t st = ++i;
+        int dep = 1;
+        while (i < s.size()) {
+            if (s[i] == '{') dep++;
+            else if (s[i] == '}' && --dep == 0) break;
+            i++;
+        }
+        if (i >= s.size()) return false;
+        res = s.substr(st, i - st);
+        i++;
+        return true;
+    }
+
+    /* Convert a sequence of atoms, until the end of a group, and return the number of elements (or -1 on failure) */
+    int expr(string& res) {
+        int n = 0;
+        while (!atend()) {
+            if (!script(res)) return -1;
+            n++;
+        }
+        return n;
+    }
+
+    /* Convert an argument, which is wrapped in '<mrow>' if it is not a single element */
+    bool arg(string& res) {
+        skip();
+        if (i >= s.size()) return false;
+        if (s[i] == '{') {
+            i++;
+            string inner;
+            int n = expr(inner);
+            skip();
+            if (n < 0 || i >= s.size() || s[i] != '}') return false;
+            i++;
+            if (n == 1) {
+                res += inner;
+            } else {
+                res += "<mrow>" + inner + "</mrow>";
+            }
+            return true;
+        }
+        if ('0' <= s[i] && s[i] <= '9') {
+            /* Like TeX, an unbraced argument is a single digit ('x^12' is 'x^{1}2') */
+            res += "<mn>";
+            res += s[i++];
+            res += "</mn>";
+            return true;
+        }
+        bool large;
+        return atom(res, large);
+    }
+
+    /* Convert an atom, followed by any '_' and '^' scripts */
+    bool script(string& res) {
+        string base, sub, sup;
+        bool large = false;
+        if (!atom(base, large)) return false;
+
+        for (;;) {
+            skip();
+            if (i < s.size() && s[i] == '_' && sub.size() == 0) {
+                i++;
+                if (!arg(sub)) return false;
+            } else if (i < s.size() && s[i] == '^' && sup.size() == 0) {
+                i++;
+                if (!arg(sup)) return false;
+            } else if (i < s.size() && s[i] == '\'') {
+                /* Primes are superscripts */
+                i++;
+                sup += "<mo>′</mo>";
+            } else {
+                break;
+            }
+        }
+
+        if (sub.size() > 0 && sup.size() > 0) {
+            res += large ? "<munderover>" : "<msubsup>";
+            res += base + sub + sup;
+            res += large ? "</munderover>" : "</msubsup>";
+        } else if (sub.size() > 0) {
+            res += large ? "<munder>" : "<msub>";
+            res += base + sub;
+            res += large ? "</munder>" : "</msub>";
+        } else if (sup.size() > 0) {
+            res += large ? "<mover>" : "<msup>";
+            res += base + sup;
+            res += large ? "</mover>" : "</msup>";
+        } else {
+            res += base;
+        }
+        return true;
+    }
+
+    /* Convert a single atom, setting 'large' if it takes limits above and below */
+    bool atom(string& res, bool& large) {
+        skip();
+        large = false;
+        if (i >= s.size()) return false;
+        char c = s[i];
+
+        if (c == '{') {
+            return arg(res);
+        } else if (('0' <= c && c <= '9') || (c == '.' && i + 1 < s.size() && '0' <= s[i + 1] && s[i + 1] <= '9')) {
+            size_t st = i;
+            while (i < s.size() && (('0' <= s[i] && s[i] <= '9') || s[i] == '.')) i++;
+            res += "<mn>" + s.substr(st, i - st) + "</mn>";
+            return true;
+        } else if (isalpha((unsigned char)c)) {
+            i++;
+            res += "<mi>";
+            res += c;
+            res += "</mi>";
+            return true;
+        } else if (c == '\\') {
+            i++;
+            return cmd(res, large);
+        } else if (strchr("+-=<>*/()[]|,;:!.?", c)) {
+            i++;
+            res += "<mo>";
+            htmlesc(res, &s[i - 1], 1);
+            res += "</mo>";
+            return true;
+        }
+
+        /* Unsupported character (including '_' and '^' without a base) */
+        return false;
+    }
+
+    /* Convert a delimiter for '\left' or '\right', with '.' meaning none */
+    bool delim(string& res) {
+        skip();
+        if (i >= s.size()) return false;
+        string d;
+        if (s[i] == '\\') {
+            i++;
+            string name = command();
+            const unordered_map<string, Sym>& syms = symbols();
+            unordered_map<string, Sym>::const_iterator it = syms.find(name);
+            if (it == syms.end() || it->second.kind != SYM_MO) return false;
+            d = it->second.text;
+        } else if (strchr("()[]|/.<>", s[i])) {
+            if (s[i] == '<') d = "⟨";
+            else if (s[i] == '>') d = "⟩";
+            else if (s[i] != '.') d = s[i];
+            i++;
+        } else {
+            return false;
+        }
+
+        if (d.size() > 0) {
+            res += "<mo fence='true' stretchy='true'>" + d + "</mo>";
+        }
+        return true;
+    }
+
+    /* Convert a '\begin{...}' environment (after the name has been read) */
+    bool env(string& res, const string& name) {
+        const char *l = NULL, *r = NULL;
+        if (name == "pmatrix") l = "(", r = ")";
+        else if (name == "bmatrix") l = "[", r = "]";
+        else if (name == "Bmatrix") l = "{", r = "}";
+        else if (name == "vmatrix") l = "|", r = "|";
+        else if (name == "Vmatrix") l = "‖", r = "‖";
+        else if (name != "matrix" && name != "array" && name != "cases") return false;
+
+        if (name == "cases") l = "{";
+        if (name == "array") {
+            /* Column spec is ignored */
+            string spec;
+            if (!rawgroup(spec)) return false;
+        }
+
+        string tab = "<mtable>";
+        for (;;) {
+            tab += "<mtr>";
+            for (;;) {
+                string cell;
+                if (expr(cell) < 0) return false;
+                tab += "<mtd>" + cell + "</mtd>";
+                skip();
+                if (i < s.size() && s[i] == '&') {
+                    i++;
+                } else {
+                    break;
+                }
+            }
+            tab += "</mtr>";
+            if (next("\\\\")) {
+                i += 2;
+            } else {
+                break;
+            }
+        }
+        tab += "</mtable>";
+
+        string end;
+        if (!next("\\end")) return false;
+        i += 4;
+        if (!rawgroup(end) || end != name) return false;
+
+        res += "<mrow>";
+        if (l) res += (string)"<mo fence='true' stretchy='true'>" + l + "</mo>";
+        res += tab;
+        if (r) res += (string)"<mo fence='true' stretchy='true'>" + r + "</mo>";
+        res += "</mrow>";
+        return true;
+    }
+
+    /* Convert a command (after the '\') */
+    bool cmd(string& res, bool& large) {
+        string name = command();
+
+        const unordered_map<string, Sym>& syms = symbols();
+        unordered_map<string, Sym>::const_iterator it = syms.find(name);
+        if (it != syms.end()) {
+            const Sym& sym = it->second;
+            switch (sym.kind) {
+            case SYM_MI:
+                res += (string)"<mi>" + sym.text + "</mi>";
+                break;
+            case SYM_MIN:
+                res += (string)"<mi mathvariant='normal'>" + sym.text + "</mi>";
+                break;
+            case SYM_FUNC:
+                res += (string)"<mi>" + sym.text + "</mi>";
+                break;
+            case SYM_MO:
+                res += (string)"<mo>" + sym.text + "</mo>";
+                break;
+            case SYM_LARGE:
+                if (isalpha((unsigned char)sym.text[0])) {
+                    res += (string)"<mo movablelimits='true' form='prefix'>" + sym.text + "</mo>";
+                } else {
+                    res += (string)"<mo>" + sym.text + "</mo>";
+                }
+                large = true;
+                break;
+            }
+            return true;
+        }
+
+        const char* sp = spacewidth(name);
+        if (sp) {
+            res += (string)"<mspace width='" + sp + "'/>";
+            return true;
+        }
+
+        if (name == "frac" || name == "dfrac" || name == "tfrac") {
+            string num, den;
+            if (!arg(num) || !arg(den)) return false;
+            res += "<mfrac>" + num + den + "</mfrac>";
+            return true;
+        } else if (name == "sqrt") {
+            skip();
+            if (i < s.size() && s[i] == '[') {
+                /* '\sqrt[n]{x}' */
+                i++;
+                string idx;
+                bool lastbrk = inbrk;
+                inbrk = true;
+                int n = expr(idx);
+                inbrk = lastbrk;
+                skip();
+                if (n < 0 || i >= s.size() || s[i] != ']') return false;
+                i++;
+                string rad;
+                if (!arg(rad)) return false;
+                res += "<mroot>" + rad + (n == 1 ? idx : "<mrow>" + idx + "</mrow>") + "</mroot>";
+            } else {
+                string rad;
+                if (!arg(rad)) return false;
+                res += "<msqrt>" + rad + "</msqrt>";
+            }
+            return true;
+        } else if (name == "left") {
+            string inner;
+            res += "<mrow>";
+            if (!delim(res)) return false;
+            if (expr(inner) < 0 || !next("\\right")) return false;
+            i += 6;
+            res += inner;
+            if (!delim(res)) return false;
+            res += "</mrow>";
+            return true;
+        } else if (name == "begin") {
+            string env_name;
+            return rawgroup(env_name) && env(res, env_name);
+        } else if (name == "text" || name == "textrm" || name == "mbox") {
+            string text;
+            if (!rawgroup(text)) return false;
+            res += "<mtext>";
+            htmlesc(res, text.data(), text.size());
+            res += "</mtext>";
+            return true;
+        } else if (name == "mathrm" || name == "mathbf" || name == "mathit" || name == "mathbb" || name == "mathcal" || name == "operatorname") {
+            string text;
+            if (!rawgroup(text)) return false;
+            const char* var = name == "mathbf" ? "bold" : name == "mathit" ? "italic" : name == "mathbb" ? "double-struck" : name == "mathcal" ? "script" : "normal";
+            res += (string)"<mi mathvariant='" + var + "'>";
+            htmlesc(res, text.data(), text.size());
+            res += "</mi>";
+            return true;
+        }
+
+        /* Unsupported command */
+        return false;
+    }
+
+};
+
+bool tex2mathml(string& res, const string& tex, bool block) {
+    TeX t(tex);
+    string body;
+    int n = t.expr(body);
+    if (n < 0 || t.i < tex.size()) {
+        /* Failed, or stopped early (for example, on an unmatched '}') */
+        return false;
+    }
+
+    res += block ? "<math display='block'>" : "<math>";
+    if (n == 1) {
+        res += body;
+    } else {
+        res += "<mrow>" + body + "</mrow>";
+    }
+    res += "</math>";
+    return true;
+}
+
+}
@@ -39,22 +39,188 @@ string readall(const string& fname) {
     return string(istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
 }
 
+char* mapall(const string& fname, size_t& size) {
+    int fd = ::open(fname.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) ::close(fd);
+        throw runtime_error((string)"Unknown file: " + fname);
+    }
+    size = st.st_size;
+
+    /* Reserve an extra page, which stays zeroed (past the end of the file), and then map the file over the
+     *   start of it
+     */
+    size_t pg = sysconf(_SC_PAGESIZE);
+    size_t total = (size / pg + 1) * pg;
+    char* res = (char*)mmap(NULL, total, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (res == MAP_FAILED) {
+        ::close(fd);
+        throw runtime_error((string)"Failed to map '" + fname + "': " + strerror(errno));
+    }
+    if (size > 0 && mmap(res, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        int e = errno;
+        munmap(res, total);
+        ::close(fd);
+        throw runtime_error((string)"Failed to map '" + fname + "': " + strerror(e));
+    }
+    ::close(fd);
+
+    /* It is read once, front to back */
+    madvise(res, size, MADV_SEQUENTIAL);
+    return res;
+}
+
+void unmapall(char* data, size_t size) {
+    size_t pg = sysconf(_SC_PAGESIZE);
+    munmap(data, (size / pg + 1) * pg);
+}
+
+
+/* Copy the rest of 'in' to 'out' with 'read()' and 'write()' */
+static void copyfd(int in, int out, const string& dest) {
+    char buf[1 << 16];
+    while (true) {
+        ssize_t n = ::read(in, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            throw runtime_error((string)"Failed to copy to '" + dest + "': " + strerror(errno));
+        }
+        if (n == 0) break;
+        for (ssize_t i = 0; i < n; ) {
+            ssize_t w = ::write(out, buf + i, n - i);
+            if (w < 0 && errno == EINTR) continue;
+            if (w < 0) {
+                throw runtime_error((string)"Failed to copy to '" + dest + "': " + strerror(errno));
+            }
+            i += w;
+        }
+    }
+}
 
-void copyfile(const string& dest, const string& src) {
-    std::ifstream srcfp(src, std::ios::binary);
-    if (!srcfp.is_open()) {
+bool copyfile(const string& dest, const string& src) {
+    int in = ::open(src.c_str(), O_RDONLY);
+    if (in < 0) {
         throw runtime_error((string)"Unknown file: " + src);
     }
-    std::ofstream destfp(dest, std::ios::binary);
-    if (!destfp.is_open()) {
+    struct stat sst, dst;
+    fstat(in, &sst);
+
+    /* Skip it if the destination already has the same contents */
+    if (stat(dest.c_str(), &dst) == 0 && dst.st_size == sst.st_size && readall(dest) == readall(src)) {
+        ::close(in);
+        return false;
+    }
+
+    int out = ::open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (out < 0) {
+        ::close(in);
         throw runtime_error((string)"Unknown file: " + dest);
     }
-    destfp << srcfp.rdbuf();
+
+    try {
+        /* Try to share the data (on filesystems that support it), then to copy inside the kernel, and then
+         *   fall back to copying through a buffer
+         */
+        bool done = false;
+#ifdef FICLONE
+        done = ioctl(out, FICLONE, in) == 0;
+#endif
+        off_t left = sst.st_size;
+        while (!done && left > 0) {
+            ssize_t n = copy_file_range(in, NULL, out, NULL, left, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                /* Not supported here (or the file shrank), so copy what is left normally */
+                copyfd(in, out, dest);
+                break;
+            }
+            left -= n;
+        }
+    } catch (exception& e) {
+        ::close(in);
+        ::close(out);
+        throw;
+    }
+
+    ::close(in);
+    ::close(out);
+    return true;
+}
+
+uint64_t hash64(const char* x, size_t n, uint64_t h) {
+    /* 64-bit FNV-1a */
+    for (size_t i = 0; i < n; ++i) {
+        h ^= (unsigned char)x[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+string hashname(const string& fname, const string& data) {
+    static const char hex[] = "0123456789abcdef";
+    uint64_t h = hash64(data.data(), data.size());
+    string tag;
+    for (int i = 0; i < 8; ++i) {
+        tag += hex[(h >> (60 - 4 * i)) & 0xF];
+    }
+
+    size_t dot = fname.rfind('.');
+    size_t slash = fname.rfind('/');
+    if (dot == string::npos || (slash != string::npos && dot < slash)) {
+        return fname + "." + tag;
+    }
+    return fname.substr(0, dot) + "." + tag + fname.substr(dot);
+}
+
+
+string anchor(const string& x) {
+    string r = "";
+    for (size_t i = 0; i < x.size(); ++i) {
+        char c = x[i];
+        if (c == '<' || c == '>' || c == '?' || c == '!' || c == '(' || c == ':' || c == ';' || c == '[' || c == ']') {
+            return r;
+        } else if (c == ' ' || c == '\t') {
+            r += "_";
+        } else {
+            r += c;
+        }
+    }
+    return r;
+}
+
+void jsonstr(string& res, const string& x) {
+    static const char hex[] = "0123456789abcdef";
+    res += '"';
+    for (size_t i = 0; i < x.size(); ++i) {
+        unsigned char c = x[i];
+        if (c == '"' || c == '\\') {
+            res += '\\';
+            res += c;
+        } else if (c < 0x20) {
+            res += "\\u00";
+            res += hex[c >> 4];
+            res += hex[c & 0xF];
+        } else {
+            res += c;
+        }
+    }
+    res += '"';
 }
 
 
 vector<Token> tokenize(const string& src) {
     vector<Token> res;
+    Lexer lex(src.data(), src.size());
+    lex.lex(res, SIZE_MAX);
+    return res;
+}
+
+void Lexer::lex(vector<Token>& res, size_t n) {
+    if (done) return;
+
+    /* Stop once there are this many tokens */
+    size_t lim = n < SIZE_MAX - res.size() ? res.size() + n : SIZE_MAX;
 
     /* Yields whether the next string is '_str' */
     #define NEXTIS(_str) (strncmp(&src[i], _str, sizeof(_str) - 1) == 0)
@@ -81,15 +247,10 @@ vector<Token> tokenize(const string& src) {
         res.push_back(Token(_kind, spos, i - spos, sline, scol)); \
     } while (0)
 
-    /* Position in the string */
-    int line = 0, col = 0;
-
     /* Start of token values */
     int sline = 0, scol = 0, spos = 0;
 
-    int sl = src.size();
-    int i = 0;
-    while (!DONE) {
+    while (!DONE && res.size() < lim) {
         sline = line;
         scol = col;
         spos = i;
@@ -191,12 +352,13 @@ vector<Token> tokenize(const string& src) {
         }
     }
 
-    sline = line;
-    scol = col;
-    spos = i;
-    EMIT(Token::Kind::NONE);
-
-    return res;
+    if (DONE) {
+        sline = line;
+        scol = col;
+        spos = i;
+        EMIT(Token::Kind::NONE);
+        done = true;
+    }
 }
 
 